@@ -26,11 +26,13 @@
 #
 
 import sys
+import hashlib
 import itertools
 import random
 import os
 import string
 import json
+import math
 
 from f1_common import LimitFuzzer
 
@@ -133,6 +135,13 @@ class TreeNode:
 
         return node, consumed
 
+    def unparse(self):
+        # Terminal values are stored as Latin-1, following `to_bytes`
+        ret = bytes(self.val, 'latin-1')
+        for subnode in self.subnodes:
+            ret += subnode.unparse()
+        return ret
+
     def __str__(self):
         ret = ''
         if len(self) == 0:
@@ -152,6 +161,25 @@ def bytes_to_c_str(data: bytes):
     return ''.join(["\\x%02X" % x for x in data])
 
 
+def solve_linear_system(matrix, vector):
+    '''
+    Solve `matrix * x = vector` by Gaussian elimination with partial pivoting,
+    and return None if the matrix is (nearly) singular.
+    '''
+    n = len(vector)
+    rows = [row[:] + [vector[i]] for i, row in enumerate(matrix)]
+    for c in range(n):
+        p = max(range(c, n), key=lambda r: abs(rows[r][c]))
+        if abs(rows[p][c]) < 1e-12:
+            return None
+        rows[c], rows[p] = rows[p], rows[c]
+        for r in range(n):
+            if r != c and rows[r][c] != 0:
+                f = rows[r][c] / rows[c][c]
+                rows[r] = [a - f * b for a, b in zip(rows[r], rows[c])]
+    return [rows[i][n] / rows[i][i] for i in range(n)]
+
+
 class PooledFuzzer(LimitFuzzer):
     def __init__(self, grammar):
         super().__init__(grammar)
@@ -159,6 +187,8 @@ class PooledFuzzer(LimitFuzzer):
         self.c_grammar_keys = list(self.c_grammar.keys())
 
         self.MAX_SAMPLE = 255
+        # The maximal size of trees that can be enumerated
+        self.ENUM_MAX_SIZE = 256
 
         # reorder our grammar rules by cost.
         for k in self.grammar_keys:
@@ -265,9 +295,14 @@ class PyCompiledFuzzer(PooledFuzzer):
 
 
 class CFuzzer(PyCompiledFuzzer):
-    def __init__(self, grammar):
+    def __init__(self, grammar, boltzmann=False):
         super().__init__(grammar)
         assert self.ordered_grammar
+        # Precomputing the Boltzmann model is slow for large grammars, and its
+        # tables are only used by `grammar_generator -b`
+        self.boltzmann = boltzmann
+        grammar_str = json.dumps(self.grammar, sort_keys=True).encode()
+        self.grammar_hash = int(hashlib.sha256(grammar_str).hexdigest()[:16], 16)
 
     def gen_rule_src(self, rule, key, min_rule_cost):
         res = []
@@ -343,10 +378,7 @@ node_t *gen_node_%(name)s(int max_len, int *consumed, int rule_index) {
 
   if (max_len < %(min_cost)d) {
     val = map_rand(%(num_cheap_trees)d);
-    size_t consumed = 0;
-    const char* ser_data = pool_ser_%(name)s[val];
-    const size_t ser_data_l = pool_l_ser_%(name)s[val];
-    node = _node_deserialize((const uint8_t*)ser_data, ser_data_l, &consumed);
+    node = node_clone(pool_tree_%(name)s[val]);
     return node;
   }
 
@@ -395,14 +427,49 @@ node_t *gen_node_%(name)s(int max_len, int *consumed, int rule_index) {
             cheap_trees = self.pool_of_trees[k]
             ser_cheap_trees = [tree.to_bytes() for tree in cheap_trees]
             ser_cheap_trees_c_str = [bytes_to_c_str(ser_tree) for ser_tree in ser_cheap_trees]
+            strs = [tree.unparse() for tree in cheap_trees]
             result.append('''
 const char* pool_ser_%(k)s[] = {%(ser_trees)s};
-const size_t pool_l_ser_%(k)s[] = {%(ser_trees_len)s};''' % {
+const size_t pool_l_ser_%(k)s[] = {%(ser_trees_len)s};
+static node_t *pool_tree_%(k)s[%(num_trees)d];
+static const char *pool_str_%(k)s[] = {%(strs)s};
+static const size_t pool_l_str_%(k)s[] = {%(strs_len)s};''' % {
                 'k': self.k_to_s(k),
                 'ser_trees': ', '.join(['"%s"' % ser_tree_c_str for ser_tree_c_str in ser_cheap_trees_c_str]),
-                'ser_trees_len': ', '.join([str(len(ser_tree)) for ser_tree in ser_cheap_trees])})
+                'ser_trees_len': ', '.join([str(len(ser_tree)) for ser_tree in ser_cheap_trees]),
+                'num_trees': len(cheap_trees),
+                'strs': ', '.join(['"%s"' % bytes_to_c_str(s) for s in strs]),
+                'strs_len': ', '.join([str(len(s)) for s in strs])})
         return '\n'.join(result)
 
+    def tree_pool_init_defs(self):
+        # Deserialize all pools once, at load time; generated cheap trees are
+        # cloned from these immutable templates
+        init_stmts = []
+        fini_stmts = []
+        for k in self.grammar_keys:
+            params = {'k': self.k_to_s(k), 'num_trees': len(self.pool_of_trees[k])}
+            init_stmts.append('''for (i = 0; i < %(num_trees)d; ++i) {
+    consumed = 0;
+    pool_tree_%(k)s[i] = _node_deserialize(
+        (const uint8_t*)pool_ser_%(k)s[i], pool_l_ser_%(k)s[i], &consumed);
+  }''' % params)
+            fini_stmts.append('''for (i = 0; i < %(num_trees)d; ++i) {
+    node_free(pool_tree_%(k)s[i]);
+    pool_tree_%(k)s[i] = NULL;
+  }''' % params)
+        return '''
+static void __attribute__((constructor)) tree_pools_init(void) {
+  int i;
+  size_t consumed;
+  %s
+}
+
+static void __attribute__((destructor)) tree_pools_fini(void) {
+  int i;
+  %s
+}''' % ('\n  '.join(init_stmts), '\n  '.join(fini_stmts))
+
     def fuzz_fn_decs(self):
         result = []
         for k in self.grammar_keys:
@@ -499,6 +566,54 @@ extern "C" {
 
 tree_t *gen_init__(int max_len);
 
+/**
+ * Generate a test case without building its tree. For the same random state,
+ * the test case is identical to the unparsed tree of `gen_init__`.
+ * @param  max_len  The maximal size of the tree
+ * @param  buf      The output buffer, which grows if needed
+ * @param  buf_size The size of the output buffer
+ * @return          The size of the generated test case
+ */
+size_t gen_init_bytes__(int max_len, uint8_t **buf, size_t *buf_size);
+
+// Whether `f1_c_gen.py` precomputed the Boltzmann model (see `--boltzmann`)
+#define GEN_HAS_BOLTZMANN %(has_boltzmann)d
+
+/**
+ * Generate a tree by Boltzmann sampling, whose length (i.e., the number of
+ * terminal characters) is between half and twice `target_len`, and close to
+ * it on average. The rule weights are precomputed from the generating
+ * functions of the grammar, and samples out of range are rejected. Unlike
+ * `gen_init__`, sizes are not skewed to small trees. If the grammar has no
+ * tree in range (e.g., `target_len` is below half of the shortest tree), and
+ * without `GEN_HAS_BOLTZMANN`, this is the same as `gen_init__`.
+ * @param  target_len The expected length of the tree
+ * @return            A newly generated tree
+ */
+tree_t *gen_init_boltzmann__(int target_len);
+
+// A hash of the grammar, e.g., to check that saved chunks belong to it
+#define GEN_GRAMMAR_HASH 0x%(grammar_hash)016xULL
+
+// The maximal size of trees that can be counted and enumerated
+#define GEN_ENUM_MAX_SIZE %(enum_max_size)d
+
+/**
+ * Count the distinct trees with exactly `size` characters
+ * @param  size The size of trees, up to `GEN_ENUM_MAX_SIZE`
+ * @return      The number of trees, which saturates at UINT64_MAX
+ */
+uint64_t gen_count__(int size);
+
+/**
+ * Map an index to a unique tree with exactly `size` characters, such that
+ * all indices below `gen_count__(size)` enumerate all such trees
+ * @param  size  The size of the tree, up to `GEN_ENUM_MAX_SIZE`
+ * @param  index The index of the tree
+ * @return       A newly created tree, or NULL if the index is out of range
+ */
+tree_t *gen_unrank__(int size, uint64_t index);
+
 %(node_type_decs)s
 const char *node_type_str(int node_type);
 
@@ -516,18 +631,23 @@ extern size_t node_num_rules[%(num_nodes)d];
         params = {
             "fuzz_fn_decs": self.fuzz_fn_decs(),
             "node_type_decs": self.node_type_decs(),
-            "num_nodes": len(self.grammar_keys) + 1
+            "num_nodes": len(self.grammar_keys) + 1,
+            "enum_max_size": self.ENUM_MAX_SIZE,
+            "has_boltzmann": 1 if self.boltzmann else 0,
+            "grammar_hash": self.grammar_hash
         }
 
         return hdr_content % params
 
     def gen_fuzz_src(self):
         src_content = '''
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "tree.h"
 #include "f1_c_fuzz.h"
+#include "helpers.h"
 #include "utils.h"
 
 extern node_t *_node_deserialize(const uint8_t *data_buf,
@@ -537,7 +657,10 @@ static inline int map_rand(int v) {
   return random_below(v);
 }
 
+// Split the remaining length among subnodes: the minimum of
+// `num_subnodes - 1` random lengths
 static int get_random_len(int num_subnodes, int total_remaining_len) {
+#ifdef LEGACY_RANDOM_LEN
   int ret = total_remaining_len;
   int temp = 0;
   for (int i = 0; i < num_subnodes - 1; ++i) {
@@ -545,9 +668,15 @@ static int get_random_len(int num_subnodes, int total_remaining_len) {
     if (temp < ret) ret = temp;
   }
   return ret;
+#else
+  if (num_subnodes <= 1 || total_remaining_len <= 0) return total_remaining_len;
+  return random_min_below(num_subnodes - 1, total_remaining_len + 1);
+#endif
 }
 %(node_type_str_defs)s
 %(ser_tree_pool_defs)s
+%(tree_pool_init_defs)s
+%(table_defs)s
 %(fuzz_fn_defs)s
 %(fuzz_fn_array_defs)s
 %(node_cost_array_defs)s
@@ -558,10 +687,18 @@ tree_t *gen_init__(int max_len) {
   int consumed = 0;
   tree->root = gen_funcs[1](max_len, &consumed, -1);
   return tree;
-}'''
+}
+%(bytes_gen_defs)s
+%(boltzmann_defs)s
+%(enum_defs)s'''
 
         params = {
             "ser_tree_pool_defs": self.ser_tree_pool_defs(),
+            "tree_pool_init_defs": self.tree_pool_init_defs(),
+            "table_defs": self.table_defs(),
+            "bytes_gen_defs": self.bytes_gen_defs(),
+            "boltzmann_defs": self.boltzmann_defs(),
+            "enum_defs": self.enum_defs(),
             "fuzz_fn_defs": self.fuzz_fn_defs(),
             "fuzz_fn_array_defs": self.fuzz_fn_array_defs(),
             "node_type_str_defs": self.node_type_str_defs(),
@@ -571,18 +708,929 @@ tree_t *gen_init__(int max_len) {
 
         return src_content % params
 
+    def gen_fit_tables(self, k):
+        # (min_rule_size, rules_that_fit) pairs, following
+        # `gen_num_candidate_rules`
+        min_rule_sizes = []
+        num_min_rules = []
+        for min_rule_size, _ in self.cost[k]:
+            if min_rule_size not in min_rule_sizes:
+                min_rule_sizes.append(min_rule_size)
+                num_min_rules.append(0)
+            num_min_rules[-1] += 1
+
+        fits = []
+        num_candidate_rules = 0
+        for i, min_rule_size in enumerate(min_rule_sizes[1:]):
+            num_candidate_rules += num_min_rules[i]
+            fits.append((min_rule_size, num_candidate_rules))
+        return fits
+
+    def gen_tables(self):
+        node_descs = ['{0, 0, 0, 0, 0, NULL, NULL, NULL, 0},']
+        rules = []
+        symbols = []
+        fits = []
+        for k in self.grammar_keys:
+            node_fits = self.gen_fit_tables(k)
+            node_descs.append(
+                '{%d, %d, %d, %d, %d, pool_tree_%s, pool_str_%s, pool_l_str_%s, %d},' % (
+                    self.cost[k][0][0], len(self.grammar[k]), len(rules),
+                    len(node_fits), len(fits), self.k_to_s(k), self.k_to_s(k),
+                    self.k_to_s(k), len(self.pool_of_trees[k])))
+            fits.extend('{%d, %d},' % fit for fit in node_fits)
+
+            for i, rule in enumerate(self.grammar[k]):
+                nkeys = len([token for token in rule if token in self.grammar])
+                rules.append('{%d, %d, %d, %d},' % (
+                    self.cost[k][i][0], nkeys, len(rule), len(symbols)))
+                for token in rule:
+                    if token in self.grammar:
+                        symbols.append('{%d, %d, NULL, 0},' % (
+                            self.k_to_id(token), self.key_cost[token]))
+                    else:
+                        esc_token_chars = [self.esc_char(c) for c in token]
+                        symbols.append('{0, 0, "%s", %d},' % (
+                            ''.join(esc_token_chars), len(esc_token_chars)))
+
+        # Avoid zero-length arrays
+        if not fits:
+            fits.append('{0, 0},')
+        if not symbols:
+            symbols.append('{0, 0, NULL, 0},')
+
+        return '''
+static const gen_node_desc_t gen_node_descs[%d] = {
+  %s
+};
+
+static const gen_rule_t gen_rules[%d] = {
+  %s
+};
+
+static const gen_fit_t gen_fits[%d] = {
+  %s
+};
+
+static const gen_symbol_t gen_symbols[%d] = {
+  %s
+};''' % (len(node_descs), '\n  '.join(node_descs),
+            len(rules), '\n  '.join(rules),
+            len(fits), '\n  '.join(fits),
+            len(symbols), '\n  '.join(symbols))
+
+    def table_defs(self):
+        return '''
+typedef struct gen_node_desc {
+  uint32_t  min_cost;
+  uint32_t  num_rules;
+  uint32_t  first_rule;  // index into `gen_rules`
+  uint32_t  num_fits;
+  uint32_t  first_fit;  // index into `gen_fits`
+  node_t ** pool;  // cheap trees
+  const char **pool_str;  // unparsed cheap trees
+  const size_t *pool_str_len;
+  uint32_t  pool_size;
+} gen_node_desc_t;
+
+typedef struct gen_rule {
+  uint32_t min_cost;
+  uint32_t num_keys;  // number of nonterminals
+  uint32_t num_symbols;
+  uint32_t first_symbol;  // index into `gen_symbols`
+} gen_rule_t;
+
+// If `max_len < min_rule_size`, only the first `rules_that_fit` rules fit
+typedef struct gen_fit {
+  uint32_t min_rule_size;
+  uint32_t rules_that_fit;
+} gen_fit_t;
+
+typedef struct gen_symbol {
+  uint32_t    id;  // 0 for terminals
+  uint32_t    cost;  // the minimal cost of the nonterminal
+  const char *val;  // the value of the terminal
+  uint32_t    val_len;
+} gen_symbol_t;
+''' + self.gen_tables() + '''
+
+#define GEN_LOCAL_STACK_SIZE 64
+
+// Pick the rule of a node of type `id`, and return -1 if the rule fits in
+// `max_len`; otherwise, return the index of a cheap tree in the pool
+static inline int gen_pick_rule(uint32_t id, int max_len, int rule_index,
+                                const gen_rule_t **rule) {
+  const gen_node_desc_t *desc = &gen_node_descs[id];
+  int val;
+
+  if (max_len < (int)desc->min_cost) {
+    return map_rand(desc->pool_size);
+  }
+
+  if (rule_index < 0 || rule_index >= (int)desc->num_rules) {
+    int rules_that_fit = desc->num_rules;
+    for (uint32_t i = 0; i < desc->num_fits; ++i) {
+      const gen_fit_t *fit = &gen_fits[desc->first_fit + i];
+      if (max_len < (int)fit->min_rule_size) {
+        rules_that_fit = fit->rules_that_fit;
+        break;
+      }
+    }
+
+    val = map_rand(rules_that_fit);
+  } else {
+    val = rule_index;
+  }
+
+  *rule = &gen_rules[desc->first_rule + val];
+  return -1;
+}
+'''
+
+    def bytes_gen_defs(self):
+        return '''
+// A partially generated node on the work stack of `gen_bytes_from_table`
+typedef struct gen_bytes_frame {
+  const gen_symbol_t *symbols;
+  uint32_t            next;  // index of the next symbol
+  uint32_t            num_symbols;
+  int                 remaining_len;
+  int                 num_keys;
+  int                 consumed;
+} gen_bytes_frame_t;
+
+static inline uint8_t *gen_bytes_append(uint8_t **buf, size_t *buf_size,
+                                        size_t *len, const char *val,
+                                        size_t val_len) {
+  if (unlikely(!maybe_grow((void **)buf, buf_size, *len + val_len))) {
+    perror("generated test case buffer allocation (maybe_grow)");
+    return NULL;
+  }
+
+  memcpy(*buf + *len, val, val_len);
+  *len += val_len;
+  return *buf;
+}
+
+// Generate the unparsed test case of a node, without building the tree. The
+// random choices are the same as `gen_node_from_table`, so the output equals
+// the unparsed tree for the same random state.
+static size_t gen_bytes_from_table(uint32_t id, int max_len, uint8_t **buf,
+                                   size_t *buf_size) {
+  size_t len = 0;
+  const gen_rule_t *rule = NULL;
+  int pool_index = gen_pick_rule(id, max_len, -1, &rule);
+  if (pool_index >= 0) {
+    const gen_node_desc_t *desc = &gen_node_descs[id];
+    gen_bytes_append(buf, buf_size, &len, desc->pool_str[pool_index],
+                     desc->pool_str_len[pool_index]);
+    return len;
+  }
+
+  gen_bytes_frame_t  local_stack[GEN_LOCAL_STACK_SIZE];
+  gen_bytes_frame_t *stack = local_stack;
+  size_t             stack_size = GEN_LOCAL_STACK_SIZE;
+  size_t             top = 0;
+
+  // The current node
+  const gen_symbol_t *symbols = &gen_symbols[rule->first_symbol];
+  uint32_t next = 0;
+  uint32_t num_symbols = rule->num_symbols;
+  int remaining_len = max_len - rule->min_cost;
+  int num_keys = rule->num_keys;
+  int cur_consumed = 0;
+  int subnode_consumed = 0;
+
+  while (true) {
+    if (next == num_symbols) {
+      if (top == 0) break;
+
+      // Return to the parent
+      subnode_consumed = cur_consumed;
+      gen_bytes_frame_t *frame = &stack[--top];
+      symbols = frame->symbols;
+      next = frame->next;
+      num_symbols = frame->num_symbols;
+      remaining_len = frame->remaining_len;
+      num_keys = frame->num_keys;
+      cur_consumed = frame->consumed;
+    } else if (!symbols[next].id) {
+      gen_bytes_append(buf, buf_size, &len, symbols[next].val,
+                       symbols[next].val_len);
+      cur_consumed += symbols[next].val_len;
+      ++next;
+      continue;
+    } else {
+      uint32_t subnode_id = symbols[next].id;
+      int subnode_max_len = get_random_len(num_keys, remaining_len);
+      num_keys -= 1;
+      subnode_max_len += symbols[next].cost;
+      remaining_len += symbols[next].cost;
+
+      pool_index = gen_pick_rule(subnode_id, subnode_max_len, -1, &rule);
+      if (pool_index < 0) {
+        // Descend into the subnode
+        if (top == stack_size) {
+          stack_size *= 2;
+          if (stack == local_stack) {
+            stack = (gen_bytes_frame_t*)malloc(
+                stack_size * sizeof(gen_bytes_frame_t));
+            memcpy(stack, local_stack, sizeof(local_stack));
+          } else {
+            stack = (gen_bytes_frame_t*)realloc(
+                stack, stack_size * sizeof(gen_bytes_frame_t));
+          }
+        }
+        gen_bytes_frame_t *frame = &stack[top++];
+        frame->symbols = symbols;
+        frame->next = next;
+        frame->num_symbols = num_symbols;
+        frame->remaining_len = remaining_len;
+        frame->num_keys = num_keys;
+        frame->consumed = cur_consumed;
+
+        symbols = &gen_symbols[rule->first_symbol];
+        next = 0;
+        num_symbols = rule->num_symbols;
+        remaining_len = subnode_max_len - rule->min_cost;
+        num_keys = rule->num_keys;
+        cur_consumed = 0;
+        subnode_consumed = 0;
+        continue;
+      }
+
+      // A cheap tree does not update `subnode_consumed`
+      const gen_node_desc_t *desc = &gen_node_descs[subnode_id];
+      gen_bytes_append(buf, buf_size, &len, desc->pool_str[pool_index],
+                       desc->pool_str_len[pool_index]);
+    }
+
+    // The nonterminal subnode is complete
+    remaining_len -= subnode_consumed;
+    cur_consumed += subnode_consumed;
+    ++next;
+  }
+
+  if (stack != local_stack) free(stack);
+  return len;
+}
+
+size_t gen_init_bytes__(int max_len, uint8_t **buf, size_t *buf_size) {
+  return gen_bytes_from_table(1, max_len, buf, buf_size);
+}'''
+
+    def boltzmann_weights(self, x, gf):
+        '''
+        Weights of all rules at `x`: a terminal contributes `x^len`, and a
+        nonterminal contributes its generating function `gf`.
+        '''
+        weights = {}
+        for k in self.grammar_keys:
+            rule_weights = []
+            for rule in self.grammar[k]:
+                w = 1.0
+                for token in rule:
+                    if token in self.grammar:
+                        w *= gf[self.grammar_keys.index(token)]
+                    else:
+                        w *= x ** len(token)
+                rule_weights.append(w)
+            weights[k] = rule_weights
+        return weights
+
+    def boltzmann_eval(self, x):
+        '''
+        Compute the generating functions of all nonterminals at `x`, where the
+        size is the number of terminal characters, and the expected sizes of
+        the Boltzmann model. Return None if `x` is not below the singularity.
+        '''
+        n = len(self.grammar_keys)
+        index = {k: i for i, k in enumerate(self.grammar_keys)}
+
+        # Newton iteration for the smallest solution of `gf = phi(gf)`
+        gf = [0.0] * n
+        for _ in range(100):
+            weights = self.boltzmann_weights(x, gf)
+            jacobian = [[1.0 if i == j else 0.0 for j in range(n)] for i in range(n)]
+            for k in self.grammar_keys:
+                for rule, w in zip(self.grammar[k], weights[k]):
+                    for j, token in enumerate(rule):
+                        if token not in self.grammar:
+                            continue
+                        d = 1.0
+                        for j2, token2 in enumerate(rule):
+                            if j2 != j:
+                                d *= gf[index[token2]] if token2 in self.grammar else x ** len(token2)
+                        jacobian[index[k]][index[token]] -= d
+            delta = solve_linear_system(
+                jacobian, [sum(weights[k]) - gf[index[k]] for k in self.grammar_keys])
+            if delta is None:
+                return None
+            gf = [g + d for g, d in zip(gf, delta)]
+            if any(not (0 <= g < 1e100) for g in gf):
+                return None
+            if all(abs(d) <= 1e-12 * g for g, d in zip(gf, delta)):
+                break
+        else:
+            return None
+        if min(gf) <= 0:
+            return None  # underflow
+
+        # Expected sizes: `size = c + M * size`, where `M` counts the expected
+        # number of nonterminals, and `c` the expected terminal characters
+        weights = self.boltzmann_weights(x, gf)
+        matrix = [[1.0 if i == j else 0.0 for j in range(n)] for i in range(n)]
+        chars = [0.0] * n
+        probs = {}
+        for k in self.grammar_keys:
+            probs[k] = [w / gf[index[k]] for w in weights[k]]
+            for rule, p in zip(self.grammar[k], probs[k]):
+                for token in rule:
+                    if token in self.grammar:
+                        matrix[index[k]][index[token]] -= p
+                    else:
+                        chars[index[k]] += p * len(token)
+        sizes = solve_linear_system(matrix, chars)
+        if sizes is None or any(size < 0 for size in sizes):
+            return None
+        return sizes[0], probs
+
+    def boltzmann_levels(self):
+        '''
+        Pick parameters of the Boltzmann model (i.e., levels), whose expected
+        sizes of the start symbol grow geometrically up to `2^24`.
+        '''
+        # Search for the singularity
+        lo, hi = 0.0, 1.0
+        while hi < 1024 and self.boltzmann_eval(hi) is not None:
+            lo, hi = hi, hi * 2
+        # Without a singularity, the grammar is finite
+        self.boltzmann_finite = hi >= 1024
+        if lo == 0.0:
+            while hi > 2 ** -20 and self.boltzmann_eval(hi) is None:
+                hi /= 2
+            if self.boltzmann_eval(hi) is None:
+                return []  # e.g., ambiguous recursion via empty rules
+            lo, hi = hi, hi * 2
+        for _ in range(30):
+            mid = (lo + hi) / 2
+            if self.boltzmann_eval(mid) is None:
+                hi = mid
+            else:
+                lo = mid
+
+        # The expected size grows fast when approaching the singularity
+        xs = [lo * 2 ** -k for k in range(8, 0, -1)]
+        xs += [lo * (1 - 2 ** (-k / 2)) for k in range(2, 61)]
+        levels = []
+        for x in xs:
+            level = self.boltzmann_eval(x)
+            if level is None:
+                continue
+            if levels and level[0] < levels[-1][0] * 1.25:
+                continue
+            levels.append(level)
+            if level[0] > 2 ** 24:
+                break
+        return levels
+
+    def boltzmann_defs(self):
+        if not self.boltzmann:
+            return '''
+tree_t *gen_init_boltzmann__(int target_len) {
+  // The Boltzmann model has not been generated (see `f1_c_gen.py --boltzmann`)
+  return gen_init__(target_len);
+}'''
+
+        levels = self.boltzmann_levels()
+        if not levels:
+            return '''
+tree_t *gen_init_boltzmann__(int target_len) {
+  // The grammar has no usable Boltzmann model
+  return gen_init__(target_len);
+}'''
+
+        cdfs = []
+        for _, probs in levels:
+            cdf = []
+            for k in self.grammar_keys:
+                total = 0.0
+                for i, p in enumerate(probs[k]):
+                    total += p
+                    # Make sure that the last rule is always picked at last
+                    cdf.append('1.0f' if i == len(probs[k]) - 1 else '%.9ef' % total)
+            cdfs.append('{%s},' % ', '.join(cdf))
+
+        return '''
+#define GEN_BOLTZMANN_NUM_LEVELS %(num_levels)d
+// Trees are resampled until their length is within `GEN_BOLTZMANN_MAX_FACTOR`
+// times the target length (in both directions)
+#define GEN_BOLTZMANN_MAX_FACTOR 2
+// The maximal number of samples, before falling back to `gen_init__`
+#define GEN_BOLTZMANN_MAX_TRIES (1 << 16)
+// Trees are hardly longer than the expected length of the last level, unless
+// the grammar has arbitrarily long trees (INT_MAX)
+#define GEN_BOLTZMANN_MAX_LEN %(max_len)s
+
+// Expected lengths of the start symbol at each level, in ascending order
+static const double gen_boltzmann_sizes[GEN_BOLTZMANN_NUM_LEVELS] = {
+  %(sizes)s
+};
+
+// Cumulative probabilities of rules (indexed as `gen_rules`) at each level
+static const float gen_boltzmann_cdfs[GEN_BOLTZMANN_NUM_LEVELS][%(num_rules)d] = {
+  %(cdfs)s
+};
+
+// A partially generated node on the work stack of `gen_node_boltzmann`
+typedef struct gen_boltzmann_frame {
+  node_t *            node;
+  const gen_symbol_t *symbols;
+  uint32_t            next;  // index of the next symbol
+} gen_boltzmann_frame_t;
+
+static inline const gen_rule_t *gen_boltzmann_pick_rule(uint32_t id,
+                                                        const float *cdf) {
+  const gen_node_desc_t *desc = &gen_node_descs[id];
+  uint32_t i = desc->first_rule, last = i + desc->num_rules - 1;
+  float u = (float)random_double();
+  while (i < last && u >= cdf[i]) ++i;
+  return &gen_rules[i];
+}
+
+// Generate a tree by a Boltzmann sampler, which picks each rule independently
+// by the probabilities of a level. Once the tree is longer than `max_len`,
+// sampling stops and NULL is returned.
+static node_t *gen_node_boltzmann(uint32_t id, const float *cdf, int max_len,
+                                  int *consumed) {
+  node_t *node = NULL;
+  int total = 0;
+
+  gen_boltzmann_frame_t  local_stack[GEN_LOCAL_STACK_SIZE];
+  gen_boltzmann_frame_t *stack = local_stack;
+  size_t                 stack_size = GEN_LOCAL_STACK_SIZE;
+  size_t                 top = 0;
+
+  // The current node, whose subnodes are NULL until they are generated
+  const gen_rule_t *rule = gen_boltzmann_pick_rule(id, cdf);
+  node_t *cur =
+      node_create_with_rule_id(id, rule - &gen_rules[gen_node_descs[id].first_rule]);
+  const gen_symbol_t *symbols = &gen_symbols[rule->first_symbol];
+  uint32_t next = 0;
+  cur->subnodes = (node_t**)calloc(rule->num_symbols, sizeof(node_t*));
+  cur->subnode_count = rule->num_symbols;
+
+  while (true) {
+    if (next == cur->subnode_count) {
+      if (top == 0) break;
+
+      // Return to the parent
+      node = cur;
+      gen_boltzmann_frame_t *frame = &stack[--top];
+      cur = frame->node;
+      symbols = frame->symbols;
+      next = frame->next;
+    } else if (!symbols[next].id) {
+      node = node_create_with_val(NODE_TERM__, symbols[next].val,
+                                  symbols[next].val_len);
+      total += symbols[next].val_len;
+      cur->subnodes[next++] = node;
+      node->parent = cur;
+      if (total <= max_len) continue;
+
+      // Too long, so free the partial tree from its root
+      while (top > 0) {
+        gen_boltzmann_frame_t *frame = &stack[--top];
+        frame->node->subnodes[frame->next] = cur;
+        cur = frame->node;
+      }
+      node_free(cur);
+      cur = NULL;
+      break;
+    } else {
+      // Descend into the subnode
+      uint32_t subnode_id = symbols[next].id;
+      if (top == stack_size) {
+        stack_size *= 2;
+        if (stack == local_stack) {
+          stack = (gen_boltzmann_frame_t*)malloc(
+              stack_size * sizeof(gen_boltzmann_frame_t));
+          memcpy(stack, local_stack, sizeof(local_stack));
+        } else {
+          stack = (gen_boltzmann_frame_t*)realloc(
+              stack, stack_size * sizeof(gen_boltzmann_frame_t));
+        }
+      }
+      gen_boltzmann_frame_t *frame = &stack[top++];
+      frame->node = cur;
+      frame->symbols = symbols;
+      frame->next = next;
+
+      rule = gen_boltzmann_pick_rule(subnode_id, cdf);
+      cur = node_create_with_rule_id(
+          subnode_id, rule - &gen_rules[gen_node_descs[subnode_id].first_rule]);
+      symbols = &gen_symbols[rule->first_symbol];
+      next = 0;
+      cur->subnodes = (node_t**)calloc(rule->num_symbols, sizeof(node_t*));
+      cur->subnode_count = rule->num_symbols;
+      continue;
+    }
+
+    // Attach the complete nonterminal subnode
+    cur->non_term_size += 1;
+    if (node->id == cur->id) cur->recursion_edge_size += 1;
+    cur->subnodes[next++] = node;
+    node->parent = cur;
+  }
+
+  if (stack != local_stack) free(stack);
+  *consumed = total;
+  return cur;
+}
+
+tree_t *gen_init_boltzmann__(int target_len) {
+  // No tree is short (or long) enough
+  int min_len = target_len / GEN_BOLTZMANN_MAX_FACTOR;
+  int max_len = target_len < INT_MAX / GEN_BOLTZMANN_MAX_FACTOR
+                    ? target_len * GEN_BOLTZMANN_MAX_FACTOR
+                    : INT_MAX;
+  if (max_len < (int)node_min_lens[1] || min_len > GEN_BOLTZMANN_MAX_LEN)
+    return gen_init__(target_len);
+
+  // Mix the two adjacent levels, such that the expected length before the
+  // rejection is `target_len` (within the range of levels)
+  int level = 0;
+  if (target_len >= gen_boltzmann_sizes[GEN_BOLTZMANN_NUM_LEVELS - 1]) {
+    level = GEN_BOLTZMANN_NUM_LEVELS - 1;
+  } else if (target_len > gen_boltzmann_sizes[0]) {
+    while (target_len >= gen_boltzmann_sizes[level + 1]) ++level;
+    double lo = gen_boltzmann_sizes[level], hi = gen_boltzmann_sizes[level + 1];
+    if (random_double() < (target_len - lo) / (hi - lo)) ++level;
+  }
+
+  // Most samples of a level are much shorter than its expected length, while
+  // a few are much longer. Instead of truncating the long ones, which biases
+  // the length, samples out of range are rejected. Long samples are stopped
+  // early, so the expected cost stays linear in the target length.
+  for (int tries = 0; tries < GEN_BOLTZMANN_MAX_TRIES; ++tries) {
+    int consumed = 0;
+    node_t *root =
+        gen_node_boltzmann(1, gen_boltzmann_cdfs[level], max_len, &consumed);
+    if (!root) continue;
+    if (consumed < min_len) {
+      node_free(root);
+      continue;
+    }
+
+    tree_t *tree = tree_create();
+    tree->root = root;
+    return tree;
+  }
+
+  return gen_init__(target_len);
+}''' % {
+            'num_levels': len(levels),
+            'max_len': ('%d' % math.ceil(levels[-1][0])
+                        if self.boltzmann_finite else 'INT_MAX'),
+            'sizes': ', '.join('%.17g' % size for size, _ in levels),
+            'num_rules': sum(len(self.grammar[k]) for k in self.grammar_keys),
+            'cdfs': '\n  '.join(cdfs)}
+
+    def enum_counts(self):
+        '''
+        Count the distinct trees of each nonterminal with exactly `n`
+        characters, for `n <= ENUM_MAX_SIZE`, saturated at UINT64_MAX. Return
+        None if a nonterminal has infinitely many trees of some size (i.e.,
+        cycles of empty derivations).
+        '''
+        max_size = self.ENUM_MAX_SIZE
+        saturated = 2 ** 64 - 1
+        counts = {k: [0] * (max_size + 1) for k in self.grammar_keys}
+        # suffixes[k][r][j][n]: the number of derivations of the symbols
+        # `j..` of the rule `r` of `k` with exactly `n` characters
+        suffixes = {k: [[[1 if n == 0 else 0 for n in range(max_size + 1)]
+                         if j == len(rule) else [0] * (max_size + 1)
+                         for j in range(len(rule) + 1)]
+                        for rule in self.grammar[k]]
+                    for k in self.grammar_keys}
+
+        for n in range(max_size + 1):
+            # Trees of size `n` may contain empty trees of size `n` as well,
+            # so iterate until a fixed point
+            for _ in range(len(self.grammar_keys) + 2):
+                changed = False
+                for k in self.grammar_keys:
+                    total = 0
+                    for rule, suffix in zip(self.grammar[k], suffixes[k]):
+                        for j in range(len(rule) - 1, -1, -1):
+                            token = rule[j]
+                            if token in self.grammar:
+                                c = counts[token]
+                                suffix[j][n] = min(saturated, sum(
+                                    c[m] * suffix[j + 1][n - m]
+                                    for m in range(n + 1)))
+                            else:
+                                m = len(token)
+                                suffix[j][n] = suffix[j + 1][n - m] if m <= n else 0
+                        total += suffix[0][n]
+                    total = min(saturated, total)
+                    if total != counts[k][n]:
+                        counts[k][n] = total
+                        changed = True
+                if not changed:
+                    break
+            else:
+                return None
+        return counts
+
+    def enum_defs(self):
+        counts = self.enum_counts()
+        if counts is None:
+            print('Cannot count trees of the grammar, which has cycles of '
+                  'empty derivations; disable the enumeration')
+            counts = {k: [0] * (self.ENUM_MAX_SIZE + 1) for k in self.grammar_keys}
+
+        rows = ['{0},']
+        for k in self.grammar_keys:
+            rows.append('{%s},' % ', '.join('%du' % c for c in counts[k]))
+
+        return '''
+// The number of distinct trees of each node type with exactly `n` characters,
+// saturated at UINT64_MAX
+static const uint64_t gen_enum_counts[%(num_nodes)d][GEN_ENUM_MAX_SIZE + 1] = {
+  %(counts)s
+};
+
+static inline uint64_t gen_enum_add(uint64_t a, uint64_t b) {
+  uint64_t c;
+  return __builtin_add_overflow(a, b, &c) ? UINT64_MAX : c;
+}
+
+static inline uint64_t gen_enum_mul(uint64_t a, uint64_t b) {
+  uint64_t c;
+  return __builtin_mul_overflow(a, b, &c) ? UINT64_MAX : c;
+}
+
+// Count the derivations of `symbols[j..num_symbols)` with exactly `n`
+// characters, for all `j` and `n <= size`. Saturation keeps the unranking
+// correct for any index below UINT64_MAX, because a saturated count is
+// always larger than the index.
+static void gen_enum_count_suffixes(const gen_symbol_t *symbols,
+                                    uint32_t num_symbols, int size,
+                                    uint64_t *suffixes) {
+  uint64_t *last = &suffixes[num_symbols * (size + 1)];
+  for (int n = 0; n <= size; ++n) last[n] = n == 0;
+
+  for (int j = num_symbols - 1; j >= 0; --j) {
+    uint64_t *cur = &suffixes[j * (size + 1)];
+    uint64_t *next = &suffixes[(j + 1) * (size + 1)];
+    for (int n = 0; n <= size; ++n) {
+      if (!symbols[j].id) {
+        int m = symbols[j].val_len;
+        cur[n] = m <= n ? next[n - m] : 0;
+        continue;
+      }
+
+      uint64_t total = 0;
+      for (int m = 0; m <= n; ++m) {
+        total = gen_enum_add(
+            total, gen_enum_mul(gen_enum_counts[symbols[j].id][m], next[n - m]));
+      }
+      cur[n] = total;
+    }
+  }
+}
+
+static node_t *gen_unrank_node(uint32_t id, int size, uint64_t index) {
+  const gen_node_desc_t *desc = &gen_node_descs[id];
+  uint32_t max_symbols = 0;
+  for (uint32_t r = 0; r < desc->num_rules; ++r) {
+    const gen_rule_t *rule = &gen_rules[desc->first_rule + r];
+    if (rule->num_symbols > max_symbols) max_symbols = rule->num_symbols;
+  }
+
+  uint64_t *suffixes =
+      (uint64_t*)malloc((max_symbols + 1) * (size + 1) * sizeof(uint64_t));
+  if (unlikely(!suffixes)) {
+    perror("suffix count allocation (gen_unrank_node)");
+    return NULL;
+  }
+
+  // Rules are ranked in their order, and so are the sizes of subnodes
+  node_t *node = NULL;
+  for (uint32_t r = 0; r < desc->num_rules && !node; ++r) {
+    const gen_rule_t *rule = &gen_rules[desc->first_rule + r];
+    const gen_symbol_t *symbols = &gen_symbols[rule->first_symbol];
+    gen_enum_count_suffixes(symbols, rule->num_symbols, size, suffixes);
+    uint64_t count = suffixes[size];
+    if (index >= count) {
+      index -= count;
+      continue;
+    }
+
+    node = node_create_with_rule_id(id, r);
+    node->subnodes = (node_t**)malloc(rule->num_symbols * sizeof(node_t*));
+    node->subnode_count = rule->num_symbols;
+
+    int n = size;
+    for (uint32_t j = 0; j < rule->num_symbols; ++j) {
+      uint64_t *next = &suffixes[(j + 1) * (size + 1)];
+      node_t *subnode = NULL;
+      if (!symbols[j].id) {
+        subnode = node_create_with_val(NODE_TERM__, symbols[j].val,
+                                       symbols[j].val_len);
+        n -= symbols[j].val_len;
+      } else {
+        for (int m = 0; m <= n; ++m) {
+          uint64_t rest = next[n - m];
+          uint64_t block = gen_enum_mul(gen_enum_counts[symbols[j].id][m], rest);
+          if (index >= block) {
+            index -= block;
+            continue;
+          }
+
+          subnode = gen_unrank_node(symbols[j].id, m, index / rest);
+          index %%= rest;
+          n -= m;
+          break;
+        }
+        node->non_term_size += 1;
+        if (symbols[j].id == id) node->recursion_edge_size += 1;
+      }
+      node->subnodes[j] = subnode;
+      subnode->parent = node;
+    }
+  }
+
+  free(suffixes);
+  return node;
+}
+
+uint64_t gen_count__(int size) {
+  if (size < 0 || size > GEN_ENUM_MAX_SIZE) return 0;
+  return gen_enum_counts[1][size];
+}
+
+tree_t *gen_unrank__(int size, uint64_t index) {
+  if (index >= gen_count__(size)) return NULL;
+
+  tree_t *tree = tree_create();
+  tree->root = gen_unrank_node(1, size, index);
+  return tree;
+}''' % {
+            'num_nodes': len(self.grammar_keys) + 1,
+            'counts': '\n  '.join(rows)}
+
     def fuzz_src(self):
         return self.gen_fuzz_hdr(), self.gen_fuzz_src()
 
 
-def main(grammar, root_dir):
+class TableCFuzzer(CFuzzer):
+    '''
+    Instead of one function with a switch over all rules per nonterminal, emit
+    one shared generator that walks the rule tables with an explicit work
+    stack (i.e., without native recursion). The generated trees are identical
+    to the ones of `CFuzzer`.
+    '''
+
+    def fuzz_fn_defs(self):
+        result = ['''
+// A partially generated node on the work stack of `gen_node_from_table`
+typedef struct gen_frame {
+  node_t *            node;
+  const gen_symbol_t *symbols;
+  uint32_t            next;  // index of the next symbol
+  int                 remaining_len;
+  int                 num_keys;
+  int                 consumed;
+} gen_frame_t;
+
+// Generate a tree without native recursion, in the same (depth-first) order
+// as the recursive generators, such that the trees are identical. The state of
+// the current node is kept in local variables; the states of its ancestors are
+// kept in the work stack.
+static node_t *gen_node_from_table(uint32_t id, int max_len, int *consumed,
+                                   int rule_index) {
+  const gen_rule_t *rule = NULL;
+  int pool_index = gen_pick_rule(id, max_len, rule_index, &rule);
+  if (pool_index >= 0) return node_clone(gen_node_descs[id].pool[pool_index]);
+
+  node_t *node = NULL;
+
+  gen_frame_t  local_stack[GEN_LOCAL_STACK_SIZE];
+  gen_frame_t *stack = local_stack;
+  size_t       stack_size = GEN_LOCAL_STACK_SIZE;
+  size_t       top = 0;
+
+  // The current node
+  node_t *cur =
+      node_create_with_rule_id(id, rule - &gen_rules[gen_node_descs[id].first_rule]);
+  const gen_symbol_t *symbols = &gen_symbols[rule->first_symbol];
+  uint32_t next = 0;
+  int remaining_len = max_len - rule->min_cost;
+  int num_keys = rule->num_keys;
+  int cur_consumed = 0;
+  int subnode_consumed = 0;
+  cur->subnodes = (node_t**)malloc(rule->num_symbols * sizeof(node_t*));
+  cur->subnode_count = rule->num_symbols;
+
+  while (true) {
+    if (next == cur->subnode_count) {
+      if (top == 0) break;
+
+      // Return to the parent
+      node = cur;
+      subnode_consumed = cur_consumed;
+      gen_frame_t *frame = &stack[--top];
+      cur = frame->node;
+      symbols = frame->symbols;
+      next = frame->next;
+      remaining_len = frame->remaining_len;
+      num_keys = frame->num_keys;
+      cur_consumed = frame->consumed;
+    } else if (!symbols[next].id) {
+      node = node_create_with_val(NODE_TERM__, symbols[next].val,
+                                  symbols[next].val_len);
+      cur_consumed += symbols[next].val_len;
+      cur->subnodes[next++] = node;
+      node->parent = cur;
+      continue;
+    } else {
+      uint32_t subnode_id = symbols[next].id;
+      int subnode_max_len = get_random_len(num_keys, remaining_len);
+      num_keys -= 1;
+      subnode_max_len += symbols[next].cost;
+      remaining_len += symbols[next].cost;
+
+      pool_index = gen_pick_rule(subnode_id, subnode_max_len, -1, &rule);
+      if (pool_index < 0) {
+        // Descend into the subnode
+        if (top == stack_size) {
+          stack_size *= 2;
+          if (stack == local_stack) {
+            stack = (gen_frame_t*)malloc(stack_size * sizeof(gen_frame_t));
+            memcpy(stack, local_stack, sizeof(local_stack));
+          } else {
+            stack = (gen_frame_t*)realloc(stack,
+                                          stack_size * sizeof(gen_frame_t));
+          }
+        }
+        gen_frame_t *frame = &stack[top++];
+        frame->node = cur;
+        frame->symbols = symbols;
+        frame->next = next;
+        frame->remaining_len = remaining_len;
+        frame->num_keys = num_keys;
+        frame->consumed = cur_consumed;
+
+        cur = node_create_with_rule_id(
+            subnode_id, rule - &gen_rules[gen_node_descs[subnode_id].first_rule]);
+        symbols = &gen_symbols[rule->first_symbol];
+        next = 0;
+        remaining_len = subnode_max_len - rule->min_cost;
+        num_keys = rule->num_keys;
+        cur_consumed = 0;
+        subnode_consumed = 0;
+        cur->subnodes = (node_t**)malloc(rule->num_symbols * sizeof(node_t*));
+        cur->subnode_count = rule->num_symbols;
+        continue;
+      }
+
+      // A cheap tree does not update `subnode_consumed`
+      node = node_clone(gen_node_descs[subnode_id].pool[pool_index]);
+    }
+
+    // Attach the complete nonterminal subnode
+    remaining_len -= subnode_consumed;
+    cur_consumed += subnode_consumed;
+    cur->non_term_size += 1;
+    if (node->id == cur->id) cur->recursion_edge_size += 1;
+    cur->subnodes[next++] = node;
+    node->parent = cur;
+  }
+
+  if (stack != local_stack) free(stack);
+  *consumed = cur_consumed;
+  return cur;
+}''']
+        for k in self.grammar_keys:
+            result.append('''
+node_t *gen_node_%(name)s(int max_len, int *consumed, int rule_index) {
+  return gen_node_from_table(NODE_%(node_type)s, max_len, consumed, rule_index);
+}''' % {'name': self.k_to_s(k), 'node_type': self.k_to_s(k).upper()})
+        return '\n'.join(result)
+
+
+def main(grammar, root_dir, table=False, boltzmann=False):
     random.seed(0)  # Fixed seed
 
     c_grammar = grammar
 
     hdr_path = os.path.join(root_dir, 'include/f1_c_fuzz.h')
     src_path = os.path.join(root_dir, 'src/f1_c_fuzz.c')
-    fuzz_hdr, fuzz_src = CFuzzer(c_grammar).fuzz_src()
+    fuzzer_class = TableCFuzzer if table else CFuzzer
+    fuzzer = fuzzer_class(c_grammar, boltzmann=boltzmann)
+    fuzz_hdr, fuzz_src = fuzzer.fuzz_src()
     with open(hdr_path, 'w') as f:
         print(fuzz_hdr, file=f)
     with open(src_path, 'w') as f:
@@ -590,10 +1638,12 @@ def main(grammar, root_dir):
 
 
 if __name__ == '__main__':
-    if len(sys.argv) < 3:
-        print(sys.argv[0] + ' </path/to/grammar/file> </path/to/output/dir>')
+    flags = sys.argv[3:]
+    if len(sys.argv) < 3 or any(f not in ('--table', '--boltzmann') for f in flags):
+        print(sys.argv[0] + ' </path/to/grammar/file> </path/to/output/dir> [--table] [--boltzmann]')
         sys.exit(1)
 
     grammar_file_path = sys.argv[1]
     with open(grammar_file_path, 'r') as fp:
-        main(json.load(fp), sys.argv[2])
+        main(json.load(fp), sys.argv[2], table='--table' in flags,
+             boltzmann='--boltzmann' in flags)
@@ -80,8 +80,27 @@ class AntlrG(Sanitize):
                          if t not in grammar else self.to_key(t)
                          for t in rule])
 
+    def rule_dispatch(self):
+        '''
+        Emit a parser member that invokes a rule by its index, so that a
+        fragment of a test case can be parsed as a given non-terminal. Rule
+        indices match the node types in `f1_c_fuzz.h` (0 is the `entry` rule).
+        '''
+        cases = '\n    '.join(['case %d: return %s();' % (i + 1, self.to_key(k))
+                               for i, k in enumerate(self.grammar_keys)])
+        return '''\
+@parser::members {
+antlr4::ParserRuleContext *parseRuleByIndex(size_t ruleIndex) {
+  switch (ruleIndex) {
+    %s
+    default: return nullptr;
+  }
+}
+}''' % cases
+
     def translate(self):
         lines = ['grammar Grammar;']
+        lines.append(self.rule_dispatch())
         entries = '\n    | '.join([self.to_key(entry_k) + ' EOF' for entry_k in self.entry_keys])
         lines.append('''\
 entry
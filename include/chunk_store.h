@@ -7,27 +7,129 @@
 extern "C" {
 #endif
 
+typedef struct chunk_store_stats {
+
+  size_t num_chunks;     // the number of chunks that can be picked as donors
+  size_t size;           // the current memory footprint (in bytes)
+  size_t num_evictions;  // the number of evicted chunks
+
+  size_t   total_len;        // the total length (in bytes) of all chunks
+  size_t   num_added_trees;  // the number of stored trees
+  size_t   num_added_nodes;  // the number of subtrees of the stored trees
+  size_t   num_duplicates;   // subtrees that have been stored already
+  uint64_t insert_time_us;   // the total time of storing trees
+  size_t   num_queued;       // trees that wait for the background thread
+  size_t   num_dropped;      // trees skipped, as too many trees were queued
+  size_t   num_full;         // trees skipped, as the shared chunk store is full
+  size_t   num_lookups;      // the number of requested alternative nodes
+  size_t   num_misses;       // requests without an alternative node
+
+} chunk_store_stats_t;
+
 /**
  * Initialize the chunk store
+ * @param max_size The maximal memory footprint (in bytes) of the chunk store.
+ *                 Random chunks, preferably of node types with more chunks,
+ *                 are evicted to stay below it. 0 means no limit.
+ */
+void chunk_store_init(size_t max_size);
+
+/**
+ * Keep the chunks in a file, which is mapped into the memory of all fuzzer
+ * instances that use the same file. Subtrees are then stored once for all
+ * instances, and splicing picks donors from the chunks of all instances.
+ * @param  path The path to the file, which is created if it does not exist
+ * @param  size The size (in bytes) of a new file. Once the file is full, new
+ *              chunks are not stored anymore.
+ * @return      True if the file can be used; otherwise, False (the chunk store
+ *              of this process is used instead)
+ */
+bool chunk_store_share(const char *path, size_t size);
+
+/**
+ * Start a background thread that stores the added trees, so that
+ * `chunk_store_add_tree` only queues them. New chunks are published to
+ * splicing in batches, and splicing never waits for the thread.
+ * @return True if the thread is running; otherwise, False (trees are stored
+ *         synchronously)
+ */
+bool chunk_store_start_worker();
+
+/**
+ * Wait until all queued trees are stored and can be picked by splicing. This
+ * returns immediately if there is no background thread.
  */
-void chunk_store_init();
+void chunk_store_flush();
 
 /**
- * Add all subtrees in a tree to the chunk store
+ * Add all subtrees in a tree to the chunk store. With a background thread,
+ * the tree is only queued (see `chunk_store_start_worker`), or skipped if too
+ * many trees are queued already.
  * @param tree A given tree
  */
 void chunk_store_add_tree(tree_t *tree);
 
 /**
  * Get a seen node from the chunk store, which has the same type as the given
- * `node`
+ * `node`. The node may be shared with the chunk store, so it must not be
+ * modified, and it is released by `node_free`.
  * @param node The given node
  * @return     An alternative node that has the same type as `node`
  */
 node_t *chunk_store_get_alternative_node(node_t *node);
 
 /**
- * Clear all stored chunks
+ * Like `chunk_store_get_alternative_node`, but the picked node is not longer
+ * than `max_len` bytes (see `node_get_data_len`). Chunks are indexed by their
+ * lengths, so no chunk is tried in vain.
+ * @param node    The given node
+ * @param max_len The maximal length of the alternative node
+ * @return        An alternative node that has the same type as `node`, or
+ *                NULL if no stored node is short enough
+ */
+node_t *chunk_store_get_alternative_node_within(node_t *node, size_t max_len);
+
+/**
+ * Save all chunks to a snapshot file, so that a restarted fuzzer does not
+ * have to rebuild the chunk store. The shared chunk store is not saved.
+ * @param  path The path to the snapshot file
+ * @return      True if the snapshot is saved; otherwise, False
+ */
+bool chunk_store_save(const char *path);
+
+/**
+ * Load the chunks of a snapshot file, in addition to the stored chunks
+ * @param  path The path to the snapshot file
+ * @return      True if the snapshot is loaded; otherwise, False (e.g., the
+ *              file does not exist)
+ */
+bool chunk_store_load(const char *path);
+
+/**
+ * Get the statistics of the chunk store
+ * @param stats The statistics, which are filled by this function
+ */
+void chunk_store_get_stats(chunk_store_stats_t *stats);
+
+/**
+ * Get the number of chunks of each node type
+ * @param num_chunks An array of `num_types` counts, which is filled by this
+ *                   function
+ * @param num_types  The size of the array
+ */
+void chunk_store_get_type_stats(size_t *num_chunks, size_t num_types);
+
+/**
+ * Write the statistics of the chunk store to a file, in the format of the
+ * `fuzzer_stats` file of afl-fuzz
+ * @param  path The path to the statistics file
+ * @return      True if the file is written; otherwise, False
+ */
+bool chunk_store_write_stats(const char *path);
+
+/**
+ * Clear all stored chunks, and stop the background thread. Queued trees are
+ * discarded.
  */
 void chunk_store_clear();
 
@@ -18,6 +18,7 @@
 #include "helpers.h"
 #include "tree.h"
 #include "list.h"
+#include "utils.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -27,6 +28,24 @@ extern "C" {
 extern size_t default_random_mutation_steps;
 extern size_t default_random_recursive_mutation_steps;
 extern size_t default_splicing_mutation_steps;
+// maximal size (MB) of the in-memory parse cache
+extern size_t default_parse_cache_max_mb;
+// maximal size (MB) of the parse cache directory
+extern size_t default_parse_cache_dir_max_mb;
+// maximal percentage of invalid tokens in a parsed test case
+extern size_t default_max_invalid_token_percent;
+// number of generated samples per grammar rule to warm up the parser
+extern size_t default_parser_warm_up_num;
+// number of cached subtrees per node type and length bucket
+extern size_t default_gen_cache_size;
+// probability (in percent) of regenerating a cached subtree
+extern size_t default_gen_cache_refresh_percent;
+// maximal memory footprint (MB) of the chunk store
+extern size_t default_chunk_store_max_mb;
+// interval (seconds) between snapshots of the chunk store
+extern size_t default_chunk_store_save_interval;
+// whether new chunks are stored in a background thread
+extern size_t default_chunk_store_worker;
 
 typedef struct afl {
 
@@ -36,6 +55,9 @@ typedef struct my_mutator {
 
   afl_t *afl;
 
+  // RNG context of this instance
+  random_state_t random_state;
+
   bool tree_out_dir_exist;
 
   const uint8_t *filename_cur;
@@ -80,6 +102,14 @@ typedef struct my_mutator {
   char tree_fn_cur[PATH_MAX];
   char new_tree_fn[PATH_MAX];
 
+  // Snapshot of the chunk store, in the tree output directory
+  char   chunk_store_fn[PATH_MAX];
+  time_t chunk_store_saved_at;
+
+  // Statistics of the chunk store, in the tree output directory
+  char   chunk_store_stats_fn[PATH_MAX];
+  time_t chunk_store_stats_written_at;
+
 } my_mutator_t;
 
 my_mutator_t *afl_custom_init(afl_t *afl, unsigned int seed);
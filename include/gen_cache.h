@@ -0,0 +1,55 @@
+#ifndef __GEN_CACHE_H__
+#define __GEN_CACHE_H__
+
+#include "tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gen_cache_stats {
+
+  size_t hits;       // subtrees cloned from a reservoir
+  size_t misses;     // subtrees generated from scratch
+  size_t num_nodes;  // subtrees kept in all reservoirs
+
+} gen_cache_stats_t;
+
+/**
+ * Initialize the generation cache, which keeps a reservoir of recently
+ * generated subtrees for each node type. All subtrees of a reservoir are
+ * generated with the same `max_len`, and requesting another `max_len` empties
+ * the reservoir.
+ * @param reservoir_size The number of subtrees per reservoir; 0 disables the
+ *                       cache
+ * @param refresh_prob   The probability of generating a new subtree (and
+ *                       replacing a random one in the reservoir), even if the
+ *                       reservoir is full
+ */
+void gen_cache_init(size_t reservoir_size, double refresh_prob);
+
+/**
+ * Generate a subtree of a given node type, or clone one from the cache
+ * @param  id       The node type
+ * @param  max_len  The maximal length of the subtree
+ * @param  consumed The length of the subtree
+ * @return          A newly created subtree
+ */
+node_t *gen_cache_gen_node(int id, int max_len, int *consumed);
+
+/**
+ * Get the hit-rate statistics of the generation cache
+ * @param stats The output statistics
+ */
+void gen_cache_get_stats(gen_cache_stats_t *stats);
+
+/**
+ * Free all cached subtrees and disable the cache
+ */
+void gen_cache_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
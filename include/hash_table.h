@@ -0,0 +1,79 @@
+#ifndef __HASH_TABLE_H__
+#define __HASH_TABLE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A 128-bit hash (e.g., XXH3), which is used as a key as-is
+typedef struct hash_key {
+
+  uint64_t low64, high64;
+
+} hash_key_t;
+
+typedef struct hash_table_entry {
+
+  hash_key_t key;
+  void *     value;  // NULL for empty slots
+
+} hash_table_entry_t;
+
+// An open-addressing hash table with linear probing. Keys are already hashes,
+// so they are never hashed again.
+typedef struct hash_table {
+
+  hash_table_entry_t *entries;
+  size_t              capacity;  // always a power of two
+  size_t              size;
+
+} hash_table_t;
+
+/**
+ * Initialize an empty hash table
+ * @param table    The hash table
+ * @param capacity The expected number of entries, which avoids resizing
+ * @return         True if the table is initialized; otherwise, False
+ */
+bool hash_table_init(hash_table_t *table, size_t capacity);
+
+/**
+ * Free all memory of the hash table, but not the stored values
+ * @param table The hash table
+ */
+void hash_table_deinit(hash_table_t *table);
+
+/**
+ * Look up a key in the hash table
+ * @param  table The hash table
+ * @param  key   The key
+ * @return       A pointer to the stored value; otherwise, NULL
+ */
+void **hash_table_get(hash_table_t *table, hash_key_t key);
+
+/**
+ * Insert a key, or update the value of an existing key
+ * @param  table The hash table
+ * @param  key   The key
+ * @param  value The value, which must not be NULL
+ * @return       True if the value is stored; otherwise, False
+ */
+bool hash_table_set(hash_table_t *table, hash_key_t key, void *value);
+
+/**
+ * Remove a key from the hash table
+ * @param  table The hash table
+ * @param  key   The key
+ * @return       True if the key exists in the table; otherwise, False
+ */
+bool hash_table_remove(hash_table_t *table, hash_key_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
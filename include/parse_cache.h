@@ -0,0 +1,59 @@
+#ifndef __PARSE_CACHE_H__
+#define __PARSE_CACHE_H__
+
+#include "tree.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Initialize the parse cache, which maps the content hash (XXH3, 128 bits) of
+ * a test case to its serialized tree. Unlike the `trees` folder, entries do
+ * not depend on the filename of the test case.
+ * @param cache_dir    An optional directory, in which serialized trees are
+ *                     shared with other processes (e.g., -M/-S instances).
+ *                     NULL means that the cache is only kept in memory.
+ * @param max_size     The maximal size (in bytes) of the in-memory cache. The
+ *                     oldest entries are evicted first.
+ * @param dir_max_size The maximal size (in bytes) of the trees in
+ *                     `cache_dir` (0 means no limit). The oldest files are
+ *                     removed first.
+ */
+void parse_cache_init(const char *cache_dir, size_t max_size,
+                      size_t dir_max_size);
+
+/**
+ * Look up the tree of a given test case
+ * @param  data_buf  The buffer of a test case
+ * @param  data_size The size of the buffer
+ * @return           A newly created tree; otherwise, NULL (cache miss)
+ */
+tree_t *parse_cache_get(const uint8_t *data_buf, size_t data_size);
+
+/**
+ * Save the tree of a given test case to the parse cache
+ * @param data_buf  The buffer of a test case
+ * @param data_size The size of the buffer
+ * @param tree      The tree of the test case
+ */
+void parse_cache_add(const uint8_t *data_buf, size_t data_size, tree_t *tree);
+
+/**
+ * Load/Parse a tree from a test case file, and skip parsing if the content of
+ * the test case has been seen before
+ * @param filename The path to the fuzzing test case
+ * @return         The parsed tree
+ */
+tree_t *parse_cache_load_tree_from_test_case(const char *filename);
+
+/**
+ * Clear all cached trees in memory. The cache directory is kept.
+ */
+void parse_cache_clear();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
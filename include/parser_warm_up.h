@@ -0,0 +1,35 @@
+#ifndef __PARSER_WARM_UP_H__
+#define __PARSER_WARM_UP_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * ANTLR4 builds the DFA of its adaptive prediction lazily, and the DFA is
+ * shared by all parser instances in the process. Therefore, the first parses
+ * after a (re)start are much slower. This function warms up the DFA by parsing
+ * generated test cases: for each grammar rule, `num` subtrees are generated
+ * and parsed as their own node type. The random numbers of the calling thread
+ * are not used.
+ * @param  num     The number of generated samples per grammar rule
+ * @param  max_len The maximal length of generated samples
+ * @return         The number of successfully parsed samples
+ */
+size_t parser_warm_up_generated(size_t num, int max_len);
+
+/**
+ * Warm up the DFA of ANTLR4 by parsing all test cases in a given directory,
+ * e.g., a saved set of sample inputs or the queue of a previous run.
+ * @param  dir The path to the directory of test cases
+ * @return     The number of successfully parsed test cases
+ */
+size_t parser_warm_up_from_dir(const char *dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
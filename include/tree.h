@@ -31,6 +31,17 @@ struct tree_node {
   node_t **subnodes;
   uint32_t subnode_count;
 
+  // The number of owners of the node in the chunk store, i.e., the array of
+  // its node type and the stored chunks that share it as a subnode
+  uint32_t ref_count;
+
+  // The number of additional owners of the node outside the chunk store, e.g.,
+  // trees that share the subtree with another tree or with the chunk store. A
+  // node is shared if any of the two counts is not zero. Shared nodes must not
+  // be modified (copy-on-write), and their `parent` is not reliable. This
+  // count is updated atomically, as the owners may be in different threads.
+  uint32_t share_count;
+
   // The following two sizes are calculated by `node_get_size`
   size_t recursion_edge_size;  // the total number of recursion edges in the
   // subtree
@@ -79,11 +90,20 @@ node_t *node_create_with_val(uint32_t id, const void *val_buf, size_t val_len);
 void node_init_subnodes(node_t *node, size_t n);
 
 /**
- * Destroy the node and recursively free all memory
+ * Destroy the node and recursively free all memory. A shared node is only
+ * freed by its last owner, and otherwise loses one owner.
  * @param node The node
  */
 void node_free(node_t *node);
 
+/**
+ * Add an owner to the node, so that it can be used by another tree without
+ * being cloned. The node must not be modified afterwards.
+ * @param  node The node
+ * @return      The same node
+ */
+node_t *node_share(node_t *node);
+
 /**
  * Destroy the node and free its memory but do not recurse
  * and destroy the subnodes.
@@ -143,6 +163,14 @@ void node_get_size(node_t *node);
  */
 bool node_replace_subnode(node_t *root, node_t *subnode, node_t *new_subnode);
 
+/**
+ * Get the length of the test case of a subtree, i.e., `tree_to_buf` without
+ * writing the data
+ * @param  node The root node of the subtree
+ * @return      The length (in bytes)
+ */
+size_t node_get_data_len(node_t *node);
+
 /**
  * Uniformly pick a subnode in a tree (`node`). As we track the number of
  * non-terminal nodes while adding the subnode (see `node_append_subnode`), for
@@ -216,6 +244,38 @@ void tree_to_buf(tree_t *tree);
  */
 tree_t *tree_from_buf(const uint8_t *data_buf, size_t data_size);
 
+/**
+ * Set the maximal ratio of invalid tokens in a test case. Before parsing, the
+ * lexer alone counts the unrecognized tokens, and `tree_from_buf` rejects the
+ * test case if the ratio is exceeded. The default value is 1.0 (disabled).
+ * @param ratio The maximal ratio of invalid tokens, ranging from [0, 1]
+ */
+void tree_set_max_invalid_token_ratio(double ratio);
+
+/**
+ * Parse the given buffer to construct a subtree rooted in the given
+ * non-terminal type. Unlike `tree_from_buf`, parsing errors are not tolerated:
+ * the whole buffer must match the rule of the node type.
+ * @param  id        The type of the root node
+ * @param  data_buf  The buffer of a fragment of a test case
+ * @param  data_size The size of the buffer
+ * @return           A newly created node; otherwise, NULL
+ */
+node_t *node_from_buf(uint32_t id, const uint8_t *data_buf, size_t data_size);
+
+/**
+ * Parse the given buffer by reusing a tree of a similar test case (e.g., the
+ * parent of a byte-level mutant). Only the smallest subtree of `base` that
+ * covers all modified bytes is re-parsed; if this fails, the whole buffer is
+ * parsed with `tree_from_buf`.
+ * @param  base      A tree whose unparsed output is close to the buffer
+ * @param  data_buf  The buffer of a test case
+ * @param  data_size The size of the buffer
+ * @return           A newly created tree
+ */
+tree_t *tree_from_buf_incremental(tree_t *base, const uint8_t *data_buf,
+                                  size_t data_size);
+
 /**
  * Serialize a given tree into binary data
  * @param tree    A given tree
@@ -237,6 +297,19 @@ tree_t *tree_deserialize(const uint8_t *data_buf, size_t data_size);
  */
 tree_t *tree_clone(tree_t *tree);
 
+/**
+ * Create a new tree, in which `node` of `tree` is replaced by `new_node`. Only
+ * the nodes on the path from the root to `node` are copied, and all other
+ * subtrees are shared with `tree` rather than cloned. Hence, neither tree may
+ * be modified in place afterwards; clone it first, as all mutations do.
+ * @param  tree     The parsing tree
+ * @param  node     A node in `tree`
+ * @param  new_node The node to be placed instead of `node`, which is owned by
+ *                  the new tree afterwards
+ * @return          The new tree, or NULL if `node` is not in `tree`
+ */
+tree_t *tree_replace_node(tree_t *tree, node_t *node, node_t *new_node);
+
 /**
  * Compare whether two parsing trees have the same architecture, and
  * corresponding nodes have the same values
@@ -280,19 +353,45 @@ tree_t *read_tree_from_file(const char *filename);
  */
 tree_t *load_tree_from_test_case(const char *filename);
 
+/**
+ * Load/Parse a tree from a test case file, reusing the unchanged subtrees of
+ * `base` (see `tree_from_buf_incremental`)
+ * @param base     A tree whose unparsed output is close to the test case
+ * @param filename The path to the fuzzing test case
+ * @return         The parsed tree
+ */
+tree_t *load_tree_from_test_case_incremental(tree_t *base, const char *filename);
+
+// A parser of test cases, e.g., `tree_from_buf_incremental`
+typedef tree_t *(*tree_parse_func_t)(tree_t *base, const uint8_t *data_buf,
+                                     size_t data_size);
+
+/**
+ * Load a tree from a test case file with the given parser, e.g., to look up
+ * the tree in a cache before parsing
+ * @param base     A tree that is passed to the parser (may be NULL)
+ * @param filename The path to the fuzzing test case
+ * @param parse    The parser of the file content
+ * @return         The parsed tree
+ */
+tree_t *load_tree_from_test_case_with(tree_t *base, const char *filename,
+                                      tree_parse_func_t parse);
+
 /**
  * Write/Serialize a tree to a file
- * @param tree     The tree to be written to the file
- * @param filename The path to the tree file
+ * @param  tree     The tree to be written to the file
+ * @param  filename The path to the tree file
+ * @return          True if the file is written; otherwise, False
  */
-void write_tree_to_file(tree_t *tree, const char *filename);
+bool write_tree_to_file(tree_t *tree, const char *filename);
 
 /**
  * Dump a tree to a test case file
- * @param tree     The tree to be written to the file
- * @param filename The path to the test case file
+ * @param  tree     The tree to be written to the file
+ * @param  filename The path to the test case file
+ * @return          True if the file is written; otherwise, False
  */
-void dump_tree_to_test_case(tree_t *tree, const char *filename);
+bool dump_tree_to_test_case(tree_t *tree, const char *filename);
 
 #ifdef __cplusplus
 }
@@ -58,12 +58,23 @@ tree_t *random_recursive_mutation(tree_t *tree, uint8_t n);
  * subtrees with a “fitting” subtree from another tree in the queue. To do so,
  * it picks a random internal node, which becomes the root of the subtree to be
  * replaced. Then it picks from a tree in the queue a random subtree that is
- * rooted in the same nonterminal to replace the old subtree.
+ * rooted in the same nonterminal to replace the old subtree. The mutated tree
+ * shares the donor and the unchanged subtrees (see `tree_replace_node`).
  * @param  tree A parsing tree
  * @return      A mutated parsing tree
  */
 tree_t *splicing_mutation(tree_t *tree);
 
+/**
+ * Like `splicing_mutation`, but the mutated tree is not longer than
+ * `max_size` bytes, because only donors that fit into the remaining space are
+ * picked. If there is none, the tree is only cloned.
+ * @param  tree     A parsing tree
+ * @param  max_size The maximal length of the mutated tree
+ * @return          A mutated parsing tree
+ */
+tree_t *splicing_mutation_within(tree_t *tree, size_t max_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -53,6 +53,38 @@ char *strrstr(const char *haystack, const char *needle);
 #define RANDOM_RETURN uint32_t
 #endif /* WORD_SIZE_64 */
 
+/**
+ * The state of a Romu random number generator. Each mutator instance (or
+ * worker thread) owns one, so that its random numbers can be reproduced
+ * independently of others in the same process.
+ */
+typedef struct random_state {
+
+  RANDOM_RETURN seed[3];
+
+} random_state_t;
+
+/**
+ * This function selects the RNG context used by the global API (e.g.,
+ * `random_below`) in the calling thread. The generated `map_rand` and the
+ * pick functions in `tree.c` also draw from this context.
+ * @param  state The RNG context; NULL means the default context of the thread
+ * @return       The previously selected RNG context
+ */
+random_state_t *random_set_state(random_state_t *state);
+
+/**
+ * These functions are the same as `random_set_seed`, `random_next`,
+ * `random_below`, `random_double`, and `random_min_below`, but use the given
+ * RNG context instead of the selected one.
+ */
+void          random_state_set_seed(random_state_t *state, uint64_t seed);
+RANDOM_RETURN random_state_next(random_state_t *state);
+uint32_t      random_state_below(random_state_t *state, uint32_t limit);
+double        random_state_double(random_state_t *state);
+uint32_t      random_state_min_below(random_state_t *state, uint32_t num,
+                                     uint32_t limit);
+
 /**
  * This function sets the random seed for Romu random number generators
  * @param seed The random seed
@@ -78,6 +110,23 @@ RANDOM_RETURN random_next();
  */
 uint32_t random_below(uint32_t limit);
 
+/**
+ * This function generates a random floating point number, ranging from [0, 1).
+ * @return A random number in [0, 1)
+ */
+double random_double();
+
+/**
+ * This function generates the minimum of `num` random numbers in [0, limit),
+ * with the same distribution as calling `random_below(limit)` `num` times, but
+ * in constant time. The minimum of `num` uniform numbers in [0, 1) is sampled
+ * via its inverse CDF, i.e., `1 - (1 - u)^(1 / num)`.
+ * @param num   The number of random numbers
+ * @param limit The maximum limit of the generated random numbers
+ * @return      The minimum of `num` random numbers smaller than `limit`
+ */
+uint32_t random_min_below(uint32_t num, uint32_t limit);
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,30 @@
 
 using namespace antlr4;
 
+// Test cases with more invalid tokens than this ratio will not be parsed
+static double max_invalid_token_ratio = 1.0;
+
+void tree_set_max_invalid_token_ratio(double ratio) {
+  max_invalid_token_ratio = ratio;
+}
+
+/**
+ * Each lexing error skips an unrecognized character, which would end up in an
+ * error node of the parse tree. Counting them only requires the lexer, which
+ * is much cheaper than running the parser and its error recovery.
+ */
+static bool lexer_prefilter_rejects(Lexer &lexer, CommonTokenStream &tokens) {
+  if (max_invalid_token_ratio >= 1.0) return false;  // disabled
+
+  size_t num_errors = lexer.getNumberOfSyntaxErrors();
+  if (num_errors == 0) return false;
+
+  // `tokens` always ends with `EOF`
+  size_t num_tokens = tokens.size() - 1;
+  return (double)num_errors / (double)(num_errors + num_tokens) >
+         max_invalid_token_ratio;
+}
+
 node_t *node_from_parse_tree(antlr4::tree::ParseTree *t) {
   node_t *node = nullptr;
 
@@ -88,6 +112,13 @@ tree_t *tree_from_buf(const uint8_t *data_buf, size_t data_size) {
     CommonTokenStream tokens(&lexer);
     tokens.fill();
 
+    if (lexer_prefilter_rejects(lexer, tokens)) {
+#ifdef DEBUG_BUILD
+      fprintf(stderr, "ANTLR4 lexing error: Too many invalid tokens\n");
+#endif
+      return nullptr;
+    }
+
     GrammarParser parser(&tokens);
     // Disable parser error output
     parser.removeErrorListener(&ConsoleErrorListener::INSTANCE);
@@ -114,3 +145,47 @@ tree_t *tree_from_buf(const uint8_t *data_buf, size_t data_size) {
   tree->root = root;
   return tree;
 }
+
+node_t *node_from_buf(uint32_t id, const uint8_t *data_buf, size_t data_size) {
+  node_t *node;
+
+  // `0` is reserved for terminal nodes, and there is no rule to parse them
+  if (id == 0) return nullptr;
+
+  try {
+    ANTLRInputStream input((const char *)data_buf, data_size);
+    GrammarLexer     lexer(&input);
+    // Disable lexer error output
+    lexer.removeErrorListener(&ConsoleErrorListener::INSTANCE);
+
+    CommonTokenStream tokens(&lexer);
+    tokens.fill();
+
+    GrammarParser parser(&tokens);
+    // Disable parser error output
+    parser.removeErrorListener(&ConsoleErrorListener::INSTANCE);
+
+    antlr4::ParserRuleContext *parse_tree = parser.parseRuleByIndex(id);
+    if (!parse_tree) return nullptr;  // unknown node type
+
+    // Unlike `tree_from_buf`, there is no trailing `EOF` in a single rule, so
+    // we have to make sure that the whole buffer has been consumed. Error
+    // nodes are not accepted either, as the caller has a better fallback.
+    if (parser.getNumberOfSyntaxErrors() != 0 ||
+        tokens.LA(1) != antlr4::Token::EOF) {
+#ifdef DEBUG_BUILD
+      fprintf(stderr, "ANTLR4 parsing error: Partial match of rule %u\n", id);
+#endif
+      return nullptr;
+    }
+
+    node = node_from_parse_tree(parse_tree);
+  } catch (std::exception &e) {
+#ifdef DEBUG_BUILD
+    fprintf(stderr, "ANTLR4 parsing error: %s\n", e.what());
+#endif
+    return nullptr;
+  }
+
+  return node;
+}
@@ -24,9 +24,15 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "benchmark.h"
+#include "chunk_store.h"
 #include "f1_c_fuzz.h"
+#include "gen_cache.h"
+#include "hash_table.h"
+#include "parser_warm_up.h"
 #include "tree.h"
 #include "tree_mutation.h"
 #include "tree_trimming.h"
@@ -48,9 +54,12 @@ static char   label[MAX_LABEL_LEN];
 
 void bench_all() {
   bench_generating();
+  bench_random_len();
+  bench_parsing_warm_up();
   bench_parsing();
   bench_mutation();
   bench_trimming();
+  bench_hash_table();
 }
 
 void bench_parsing_test_case(const char *fn) {
@@ -104,9 +113,117 @@ void bench_generating() {
     snprintf(label, MAX_LABEL_LEN, "Generating, max_len=%d", max_len);
     bench_stats_print(label);
   }
+
+  // Subtrees of all node types that are smaller than their minimal cost, as
+  // generated in random mutation and subtree trimming (100 rounds per sample)
+  int     consumed;
+  node_t *node;
+  for (int max_len = 0; max_len < 10; ++max_len) {
+    for (int i = 0; i < BENCH_NUM; ++i) {
+      start = current_time();
+      for (int round = 0; round < 100; ++round) {
+        for (size_t id = 1; id < sizeof(gen_funcs) / sizeof(gen_funcs[0]);
+             ++id) {
+          if (node_min_lens[id] <= (size_t)max_len) continue;
+          node = gen_funcs[id](max_len, &consumed, -1);
+          node_free(node);
+        }
+      }
+      end = current_time();
+      times[i] = (end - start);
+    }
+    snprintf(label, MAX_LABEL_LEN, "Generating cheap subtrees, max_len=%d",
+             max_len);
+    bench_stats_print(label);
+  }
   printf("=========== Generating [END] ===========\n\n");
 }
 
+#define RANDOM_LEN_LIMIT (1000 + 1)
+#define RANDOM_LEN_CALLS (1000)
+#define NUM_HIST_BUCKETS (10)
+
+static uint32_t random_min_below_loop(uint32_t num, uint32_t limit) {
+  uint32_t ret = limit - 1;
+  for (uint32_t i = 0; i < num; ++i) {
+    uint32_t temp = random_below(limit);
+    if (temp < ret) ret = temp;
+  }
+  return ret;
+}
+
+static void print_hist(const char *label, size_t *hist, size_t bucket_size) {
+  printf("%s:", label);
+  for (int i = 0; i < NUM_HIST_BUCKETS; ++i) {
+    if (i == NUM_HIST_BUCKETS - 1)
+      printf(" [%zu, inf): %zu", i * bucket_size, hist[i]);
+    else
+      printf(" [%zu, %zu): %zu", i * bucket_size, (i + 1) * bucket_size,
+             hist[i]);
+  }
+  printf("\n");
+}
+
+/**
+ * Compare the length splitting of generated trees: one random number per
+ * subnode (legacy) vs. the inverse CDF of the minimum (constant time). Both
+ * should have the same distribution. The sizes of generated test cases depend
+ * on the one selected at compile time (see `ENABLE_LEGACY_RANDOM_LEN`).
+ */
+void bench_random_len() {
+  size_t hist[NUM_HIST_BUCKETS];
+  size_t bucket_size = RANDOM_LEN_LIMIT / NUM_HIST_BUCKETS;
+
+  printf("========== Random length [START] ==========\n");
+  for (uint32_t num = 1; num <= 16; num *= 2) {
+    for (int legacy = 1; legacy >= 0; --legacy) {
+      memset(hist, 0, sizeof(hist));
+      for (int i = 0; i < BENCH_NUM; ++i) {
+        start = current_time();
+        for (int j = 0; j < RANDOM_LEN_CALLS; ++j) {
+          uint32_t len = legacy ? random_min_below_loop(num, RANDOM_LEN_LIMIT)
+                                : random_min_below(num, RANDOM_LEN_LIMIT);
+          size_t   bucket = len / bucket_size;
+          ++hist[bucket < NUM_HIST_BUCKETS ? bucket : NUM_HIST_BUCKETS - 1];
+        }
+        end = current_time();
+        times[i] = (end - start);
+      }
+      snprintf(label, MAX_LABEL_LEN, "Random length (%s), %d calls, num=%u",
+               legacy ? "legacy" : "inverse CDF", RANDOM_LEN_CALLS, num);
+      bench_stats_print(label);
+      print_hist("  Histogram", hist, bucket_size);
+    }
+  }
+
+  // Sizes of generated test cases
+  tree_t *tree;
+  for (int max_len = 100; max_len < MAX_TREE_LEN; max_len *= 10) {
+    memset(hist, 0, sizeof(hist));
+    bucket_size = max_len / NUM_HIST_BUCKETS;
+    for (int i = 0; i < BENCH_NUM; ++i) {
+      start = current_time();
+      tree = gen_init__(max_len);
+      end = current_time();
+      times[i] = (end - start);
+
+      tree_to_buf(tree);
+      size_t bucket = tree->data_len / bucket_size;
+      ++hist[bucket < NUM_HIST_BUCKETS ? bucket : NUM_HIST_BUCKETS - 1];
+      tree_free(tree);
+    }
+#ifdef LEGACY_RANDOM_LEN
+    snprintf(label, MAX_LABEL_LEN, "Generating (legacy), max_len=%d", max_len);
+#else
+    snprintf(label, MAX_LABEL_LEN, "Generating (inverse CDF), max_len=%d",
+             max_len);
+#endif
+    bench_stats_print(label);
+    print_hist("  Test case sizes", hist, bucket_size);
+  }
+  printf("=========== Random length [END] ===========\n\n");
+}
+
 void bench_parsing() {
   tree_t *tree, *recovered_tree;
 
@@ -130,12 +247,122 @@ void bench_parsing() {
   printf("=========== Parsing [END] ===========\n\n");
 }
 
+static void bench_parsing_test_cases(tree_t **test_cases) {
+  tree_t *recovered_tree;
+
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    start = current_time();
+    recovered_tree =
+        tree_from_buf(test_cases[i]->data_buf, test_cases[i]->data_len);
+    end = current_time();
+    times[i] = (end - start);
+
+    tree_free(recovered_tree);
+  }
+}
+
+/**
+ * The DFA of the parser is shared in the process and never gets cold again, so
+ * the cold parsing runs in a child process, which starts from the same state.
+ */
+void bench_parsing_warm_up() {
+  tree_t *test_cases[BENCH_NUM];
+  pid_t   pid;
+
+  printf("========== Parsing Warm-up [START] ==========\n");
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    test_cases[i] = gen_init__(random_below(MAX_TREE_LEN));
+    tree_to_buf(test_cases[i]);
+  }
+
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("Cannot fork (bench_parsing_warm_up)");
+  } else if (pid == 0) {
+    bench_parsing_test_cases(test_cases);
+    bench_stats_print("Parsing, cold");
+    fflush(stdout);
+    _exit(0);
+  } else {
+    waitpid(pid, NULL, 0);
+  }
+
+  start = current_time();
+  size_t num_parsed = parser_warm_up_generated(1, 100);
+  end = current_time();
+  printf("Warm-up: %zu samples parsed in %lf s\n", num_parsed, (end - start));
+
+  bench_parsing_test_cases(test_cases);
+  bench_stats_print("Parsing, warm");
+
+  for (int i = 0; i < BENCH_NUM; ++i) tree_free(test_cases[i]);
+  printf("=========== Parsing Warm-up [END] ===========\n\n");
+}
+
 inline void bench_mutation() {
   bench_random_mutation();
   bench_random_recursive_mutation();
   bench_splicing_mutation();
 }
 
+// FNV-1a, to count distinct mutated test cases
+static uint64_t bench_hash(const uint8_t *buf, size_t len) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ buf[i]) * 0x100000001b3;
+  }
+  return hash;
+}
+
+static int bench_cmp_hash(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static size_t bench_count_distinct(uint64_t *hashes, size_t num) {
+  size_t distinct = num ? 1 : 0;
+  qsort(hashes, num, sizeof(uint64_t), bench_cmp_hash);
+  for (size_t i = 1; i < num; ++i) {
+    if (hashes[i] != hashes[i - 1]) ++distinct;
+  }
+  return distinct;
+}
+
+// Throughput vs. diversity of random mutations with the generation cache
+static void bench_random_mutation_gen_cache() {
+  static const size_t reservoir_sizes[] = {0, 16, 16, 64, 64, 64};
+  static const double refresh_probs[] = {0, 0.5, 0.1, 0.5, 0.1, 0};
+  static uint64_t     hashes[BENCH_NUM];
+  gen_cache_stats_t   stats;
+  tree_t *            tree, *mutated_tree;
+
+  tree = gen_init__(100);
+  tree_get_size(tree);
+  for (size_t c = 0; c < sizeof(refresh_probs) / sizeof(double); ++c) {
+    gen_cache_init(reservoir_sizes[c], refresh_probs[c]);
+    for (int i = 0; i < BENCH_NUM; ++i) {
+      start = current_time();
+      mutated_tree = random_mutation(tree);
+      end = current_time();
+      times[i] = (end - start);
+
+      tree_to_buf(mutated_tree);
+      hashes[i] = bench_hash(mutated_tree->data_buf, mutated_tree->data_len);
+      tree_free(mutated_tree);
+    }
+    gen_cache_get_stats(&stats);
+    snprintf(label, MAX_LABEL_LEN,
+             "Random mutation, gen cache=%zu, refresh=%.2f", reservoir_sizes[c],
+             refresh_probs[c]);
+    bench_stats_print(label);
+    printf("    hits: %zu, misses: %zu, distinct: %zu/%d\n", stats.hits,
+           stats.misses, bench_count_distinct(hashes, BENCH_NUM), BENCH_NUM);
+    gen_cache_clear();
+  }
+  tree_free(tree);
+}
+
 void bench_random_mutation() {
   tree_t *tree, *mutated_tree;
 
@@ -156,6 +383,7 @@ void bench_random_mutation() {
     snprintf(label, MAX_LABEL_LEN, "Random mutation, max_len=%d", max_len);
     bench_stats_print(label);
   }
+  bench_random_mutation_gen_cache();
   printf("=========== Random Mutation [END] ===========\n\n");
 }
 
@@ -186,7 +414,56 @@ void bench_random_recursive_mutation() {
 }
 
 void bench_splicing_mutation() {
-  // TODO: this relies on the chunk store
+  tree_t *tree, *mutated_tree;
+  node_t *node;
+
+  printf("========== Splicing Mutation [START] ==========\n");
+  // Donors come from the chunk store, which is filled with generated trees
+  chunk_store_init(0);
+  start = current_time();
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    tree = gen_init__(random_below(MAX_TREE_LEN));
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+  }
+  end = current_time();
+  printf("Chunk store: %d trees added in %lf s\n", BENCH_NUM, (end - start));
+
+  // Picking a donor alone, without mutating a tree
+  tree = gen_init__(100);
+  tree_get_non_terminal_nodes(tree);
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    node = list_get(tree->non_terminal_node_list,
+                    random_below(tree->non_terminal_node_list->size));
+
+    start = current_time();
+    for (int round = 0; round < 100; ++round) {
+      node_free(chunk_store_get_alternative_node(node));
+    }
+    end = current_time();
+    times[i] = (end - start);
+  }
+  tree_free(tree);
+  bench_stats_print("Picking a donor (100 rounds)");
+
+  for (int max_len = 0; max_len < MAX_TREE_LEN; max_len += 10) {
+    for (int i = 0; i < BENCH_NUM; ++i) {
+      tree = gen_init__(max_len);
+      tree_get_size(tree);
+
+      start = current_time();
+      mutated_tree = splicing_mutation(tree);
+      end = current_time();
+      times[i] = (end - start);
+
+      tree_free(mutated_tree);
+      tree_free(tree);
+    }
+    snprintf(label, MAX_LABEL_LEN, "Splicing mutation, max_len=%d", max_len);
+    bench_stats_print(label);
+  }
+  chunk_store_clear();
+  printf("=========== Splicing Mutation [END] ===========\n\n");
 }
 
 inline void bench_trimming() {
@@ -249,6 +526,68 @@ void bench_recursive_trimming() {
   printf("=========== Recursive Trimming, Single Node [END] ===========\n\n");
 }
 
+#define HASH_TABLE_BATCH (10000)  // BENCH_NUM batches, i.e., 10M entries
+
+// SplitMix64, to derive distinct keys from a counter
+static hash_key_t bench_hash_key(uint64_t i) {
+  uint64_t z = (i + 1) * 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return (hash_key_t){z ^ (z >> 31), i};
+}
+
+// Insertion and lookup in the table of seen chunks, at the scale of a
+// long-running chunk store
+void bench_hash_table() {
+  hash_table_t table;
+  size_t       found = 0;
+  uint64_t     key = 0;
+
+  printf("========== Hash Table [START] ==========\n");
+  if (!hash_table_init(&table, 0)) return;
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    start = current_time();
+    for (int j = 0; j < HASH_TABLE_BATCH; ++j, ++key) {
+      hash_table_set(&table, bench_hash_key(key), &table);
+    }
+    end = current_time();
+    times[i] = (end - start);
+  }
+  snprintf(label, MAX_LABEL_LEN, "Hash table, %d inserts", HASH_TABLE_BATCH);
+  bench_stats_print(label);
+
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    start = current_time();
+    for (int j = 0; j < HASH_TABLE_BATCH; ++j) {
+      key = random_below(BENCH_NUM * HASH_TABLE_BATCH);
+      if (hash_table_get(&table, bench_hash_key(key))) ++found;
+    }
+    end = current_time();
+    times[i] = (end - start);
+  }
+  snprintf(label, MAX_LABEL_LEN, "Hash table, %d lookups (hit)",
+           HASH_TABLE_BATCH);
+  bench_stats_print(label);
+
+  for (int i = 0; i < BENCH_NUM; ++i) {
+    start = current_time();
+    for (int j = 0; j < HASH_TABLE_BATCH; ++j) {
+      key = BENCH_NUM * HASH_TABLE_BATCH + random_next();
+      if (hash_table_get(&table, bench_hash_key(key))) ++found;
+    }
+    end = current_time();
+    times[i] = (end - start);
+  }
+  snprintf(label, MAX_LABEL_LEN, "Hash table, %d lookups (miss)",
+           HASH_TABLE_BATCH);
+  bench_stats_print(label);
+  printf("Entries: %zu, capacity: %zu, found: %zu\n", table.size,
+         table.capacity, found);
+
+  hash_table_deinit(&table);
+  printf("=========== Hash Table [END] ===========\n\n");
+}
+
 /**
  * The algorithm used to calculate the average and standard deviation can avoid
  * overflow.
@@ -282,6 +621,11 @@ void bench_stats_print(const char *prefix_label) {
 
 static void usage(const char *program) {
   printf("%s single </path/to/a/test/case>\n", program);
+  printf("%s random_len\n", program);
+  printf("%s warm_up\n", program);
+  printf("%s random_mutation\n", program);
+  printf("%s splicing\n", program);
+  printf("%s hash_table\n", program);
   printf("%s all\n", program);
 }
 
@@ -303,6 +647,36 @@ int main(int argc, const char *argv[]) {
     return 0;
   }
 
+  // Length splitting of generated trees
+  if (strncmp(argv[1], "random_len", 10) == 0) {
+    bench_random_len();
+    return 0;
+  }
+
+  // Cold vs. warm parsing
+  if (strncmp(argv[1], "warm_up", 7) == 0) {
+    bench_parsing_warm_up();
+    return 0;
+  }
+
+  // Random mutation, with and without the generation cache
+  if (strncmp(argv[1], "random_mutation", 15) == 0) {
+    bench_random_mutation();
+    return 0;
+  }
+
+  // Splicing mutation, with donors from the chunk store
+  if (strncmp(argv[1], "splicing", 8) == 0) {
+    bench_splicing_mutation();
+    return 0;
+  }
+
+  // Insertion and lookup of seen chunks
+  if (strncmp(argv[1], "hash_table", 10) == 0) {
+    bench_hash_table();
+    return 0;
+  }
+
   // All
   if (strncmp(argv[1], "all", 3) == 0) {
     bench_all();
@@ -27,7 +27,9 @@ void bench_all();
 void bench_parsing_test_case(const char *fn);
 
 void bench_generating();
+void bench_random_len();
 void bench_parsing();
+void bench_parsing_warm_up();
 void bench_mutation();
 void bench_random_mutation();
 void bench_random_recursive_mutation();
@@ -35,6 +37,7 @@ void bench_splicing_mutation();
 void bench_trimming();
 void bench_subtree_trimming();
 void bench_recursive_trimming();
+void bench_hash_table();
 
 void bench_stats_print(const char *label);
 
@@ -16,147 +16,535 @@
 
  */
 
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #define XXH_INLINE_ALL
 #include "xxhash.h"
-#include "list.h"
 #include "f1_c_fuzz.h"
 #include "chunk_store.h"
 #include "chunk_store_internal.h"
 #include "utils.h"
 
-// the list, in `chunk_store`, contains a collection of `node_t`
-list_map_t chunk_store;
-node_map_t seen_chunks;
+// the array, in `chunk_store`, contains a collection of `node_t`
+chunk_vector_t *chunk_store = NULL;
+size_t          chunk_store_num_types = 0;
+hash_table_t    seen_chunks;
+
+// Memory footprint of the chunk store, and its limit (0 means no limit)
+static size_t chunk_store_size = 0;
+static size_t chunk_store_max_size = 0;
+
+static size_t chunk_store_num_chunks = 0;
+static size_t chunk_store_num_evictions = 0;
+
+// Statistics of stored trees, and of requested alternative nodes
+static size_t   chunk_store_total_len = 0;
+static size_t   chunk_store_num_added_trees = 0;
+static size_t   chunk_store_num_added_nodes = 0;
+static size_t   chunk_store_num_duplicates = 0;
+static uint64_t chunk_store_insert_time_us = 0;
+static size_t   chunk_store_num_lookups = 0;
+static size_t   chunk_store_num_misses = 0;
+
+#define CHUNK_STORE_NUM_NODE_TYPES (sizeof(gen_funcs) / sizeof(gen_funcs[0]))
+
+// Memory of a chunk in the arrays of `chunk_store`, excluding the node
+#define CHUNK_INDEX_SIZE (sizeof(node_t *) + sizeof(hash_key_t) + sizeof(size_t))
+
+// A monotonic clock (in microseconds) to measure the time of storing trees
+static inline uint64_t chunk_store_time_us() {
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+}
+
+// The bucket of chunks of `len` bytes, i.e., the bit width of `len`
+static inline uint32_t chunk_store_bucket(size_t len) {
+
+  uint32_t bucket = len ? 64 - __builtin_clzll(len) : 0;
+  return bucket < CHUNK_STORE_NUM_BUCKETS ? bucket
+                                          : CHUNK_STORE_NUM_BUCKETS - 1;
+
+}
+
+// Move a chunk in the arrays of its node type
+static inline void chunk_vector_move(chunk_vector_t *vector, size_t from,
+                                     size_t to) {
+
+  vector->nodes_buf[to] = vector->nodes_buf[from];
+  vector->hashes_buf[to] = vector->hashes_buf[from];
+  vector->lens_buf[to] = vector->lens_buf[from];
+
+}
+
+static inline size_t chunk_bucket_start(const chunk_vector_t *vector,
+                                        uint32_t              b) {
+
+  return b ? vector->bucket_ends[b - 1] : 0;
+
+}
+
+// The index of the `k`-th shortest chunk of bucket `b`, which has `size` slots
+static inline size_t chunk_bucket_index(const chunk_vector_t *vector,
+                                        uint32_t b, size_t size, size_t k) {
+
+  size_t i = vector->bucket_rots[b] + k;
+  return chunk_bucket_start(vector, b) + (i < size ? i : i - size);
+
+}
+
+// The first of the `lo`-th to `hi - 1`-th shortest chunks of bucket `b` that
+// is longer than `len` (or at least `len` long, unless `longer`), or `hi`
+static size_t chunk_bucket_search(const chunk_vector_t *vector, uint32_t b,
+                                  size_t size, size_t lo, size_t hi,
+                                  size_t len, bool longer) {
+
+  while (lo < hi) {
+
+    size_t mid = lo + (hi - lo) / 2;
+    size_t mid_len = vector->lens_buf[chunk_bucket_index(vector, b, size, mid)];
+    if (longer ? mid_len > len : mid_len >= len)
+      hi = mid;
+    else
+      lo = mid + 1;
+
+  }
+
+  return lo;
+
+}
+
+// Move the empty slot of bucket `b` from the `hole`-th to the `to`-th position
+// of the sorted chunks. Instead of shifting every chunk in between, the first
+// (or last) chunk of a run of chunks with the same length is moved.
+static void chunk_bucket_move_hole(chunk_vector_t *vector, uint32_t b,
+                                   size_t size, size_t hole, size_t to) {
+
+  while (hole > to) {
+
+    size_t len =
+        vector->lens_buf[chunk_bucket_index(vector, b, size, hole - 1)];
+    size_t first = chunk_bucket_search(vector, b, size, to, hole, len, false);
+    chunk_vector_move(vector, chunk_bucket_index(vector, b, size, first),
+                      chunk_bucket_index(vector, b, size, hole));
+    hole = first;
+
+  }
+
+  while (hole < to) {
+
+    size_t len =
+        vector->lens_buf[chunk_bucket_index(vector, b, size, hole + 1)];
+    size_t last =
+        chunk_bucket_search(vector, b, size, hole + 1, to + 1, len, true) - 1;
+    chunk_vector_move(vector, chunk_bucket_index(vector, b, size, last),
+                      chunk_bucket_index(vector, b, size, hole));
+    hole = last;
 
-// Tiny implementation of fixed-length hash to text conversion
-static void uint64_to_hex(uint64_t num, char dest[16+1]) {
+  }
+
+}
 
-  // Starting at the end and working backward:
-  int i;
-  char * c = &dest[16];
+// Get the array of chunks of a node type, which is created if needed
+static chunk_vector_t *chunk_store_get_vector(uint32_t id) {
 
-  *c = '\0';
-  for (i = 0; i < 16; ++i) {
+  if (unlikely(id >= chunk_store_num_types)) {
 
-    --c;
-    *c = "0123456789ABCDEF"[num & 0xF];
-    num >>= 4;
+    size_t num_types = next_pow2(id + 1);
+    chunk_vector_t *new_store =
+        realloc(chunk_store, num_types * sizeof(chunk_vector_t));
+    if (unlikely(!new_store)) {
+
+      perror("chunk store allocation (realloc)");
+      return NULL;
+
+    }
+
+    memset(&new_store[chunk_store_num_types], 0,
+           (num_types - chunk_store_num_types) * sizeof(chunk_vector_t));
+    chunk_store = new_store;
+    chunk_store_num_types = num_types;
 
   }
 
+  return &chunk_store[id];
+
 }
 
-// Append the node and its subnodes a hash of the node and its subnodes
-static void node_update_hash(node_t *node, XXH3_state_t* hash) {
+// Hash of the fields of the node itself, excluding its subnodes. Use the
+// same fields that `node_equal()` uses, so that we can be reasonably certain
+// that if the hashes are equal than `node_equal()` will return true.
+hash_key_t node_hash_self(node_t *node) {
 
-  // Use the same fields that `node_equal()` uses, so
-  // that we can be reasonably certain that if the hashes
-  // are equal than `node_equal()` will return true.
-  XXH3_64bits_update(hash, &node->id, sizeof(node->id));
-  XXH3_64bits_update(hash, &node->rule_id, sizeof(node->rule_id));
-  XXH3_64bits_update(hash, &node->val_len, sizeof(node->val_len));
-  XXH3_64bits_update(hash, node->val_buf, node->val_len);
+  uint32_t fields[3] = {node->id, node->rule_id, (uint32_t)node->val_len};
+  uint64_t seed = XXH3_64bits(fields, sizeof(fields));
 
   // Do not consider the parent node while comparing two nodes
+  XXH128_hash_t hash =
+      XXH3_128bits_withSeed(node->val_buf, node->val_len, seed);
+  return (hash_key_t){hash.low64, hash.high64};
+
+}
+
+// Fold the hash of a subnode into the hash of its parent
+hash_key_t node_hash_combine(hash_key_t hash, hash_key_t subnode_hash) {
 
-  // subnodes
+  hash_key_t    hashes[2] = {hash, subnode_hash};
+  XXH128_hash_t combined = XXH3_128bits(hashes, sizeof(hashes));
+  return (hash_key_t){combined.low64, combined.high64};
+
+}
+
+// Create a (Merkle) hash of the node and its subnodes, which is computed from
+// the hashes of its subnodes
+hash_key_t hash_node(node_t *node) {
+
+  hash_key_t hash = node_hash_self(node);
   for (uint32_t i = 0; i < node->subnode_count; ++i) {
 
-    node_update_hash(node->subnodes[i], hash);
+    hash = node_hash_combine(hash, hash_node(node->subnodes[i]));
 
   }
 
+  return hash;
+
 }
 
-// Create a hash of the node and its subnodes
-// Use the same fields that `node_equal()` uses, so
-// that we can be reasonably certain that if the hashes
-// are equal than `node_equal()` will return true.
-void hash_node(node_t *node, char dest[16+1]) {
+// Memory of a stored node, excluding its subnodes
+static inline size_t node_footprint(node_t *node) {
 
-  // Set up a hash state so we can pass it to sub-nodes recursively:
-  XXH3_state_t hash;
-  XXH3_64bits_reset(&hash);
+  return sizeof(node_t) + node->val_size +
+         node->subnode_count * sizeof(node_t *);
 
-  node_update_hash(node, &hash);
+}
+
+static inline size_t chunk_store_footprint() {
 
-  // Need to convert the hash to text so that 0-values in the hash don't cause an inordinant amount of collisions.
-  // If we just put the 8-byte integer in as a "string" then the first byte being a zero would cause
-  // a collision approximately 1/256 of the time!
-  uint64_to_hex(XXH3_64bits_digest(&hash), dest);
+  return chunk_store_size + seen_chunks.capacity * sizeof(hash_table_entry_t);
+
+}
+
+// Drop a reference to a stored node, and free it once it is not used anymore
+static void chunk_store_release_node(node_t *node) {
+
+  if (--node->ref_count) return;
+
+  chunk_store_size -= node_footprint(node);
+
+  // The node owns its subnodes from now on. If a tree still uses the node
+  // (e.g., a spliced tree), the tree becomes its owner once it is retired.
+  for (uint32_t i = 0; i < node->subnode_count; ++i)
+    node_share(node->subnodes[i]);
+
+  for (uint32_t i = 0; i < node->subnode_count; ++i)
+    chunk_store_release_node(node->subnodes[i]);
+
+  chunk_store_retire_node(node);
 
 }
 
 /**
- * Take ownership of a node for the chunk store, storing it if unique or freeing it if not.
- * @param  node The node, which must not be owned/kept by anybody else. It also should not have a parent except when called recursively.
+ * Remove a chunk from the chunk store, so that it is no longer picked as a
+ * donor. The node itself lives on as long as other stored chunks share it.
+ * @param vector The array of chunks of the node type
+ * @param i      The index of the chunk in `vector`
  */
-void chunk_store_take_node(node_t *node) {
+static void chunk_store_evict_chunk(chunk_vector_t *vector, size_t i) {
 
-  if (!node) return;
+  node_t *node = vector->nodes_buf[i];
+  size_t  len = vector->lens_buf[i];
+  hash_table_remove(&seen_chunks, vector->hashes_buf[i]);
 
-  const char *node_type = node_type_str(node->id);
+  // Move the hole to the last slot of the bucket, whose slot is then filled
+  // by the last chunk of the next bucket, and so on
+  uint32_t bucket = chunk_store_bucket(len);
+  size_t   start = chunk_bucket_start(vector, bucket);
+  size_t   size = vector->bucket_ends[bucket] - start;
+  size_t   rot = vector->bucket_rots[bucket];
+  chunk_bucket_move_hole(vector, bucket, size, (i - start + size - rot) % size,
+                         size - 1 - rot);
+  vector->bucket_rots[bucket] = rot == size - 1 ? 0 : rot;
 
-  // add current subtree
-  char node_hash[16+1];
-  hash_node(node, node_hash);
-  node_t **seen_node = map_get(&seen_chunks, node_hash);
-  if (seen_node) {
+  size_t hole = vector->bucket_ends[bucket] - 1;
+  for (uint32_t b = bucket; b < CHUNK_STORE_NUM_BUCKETS; ++b) {
 
-    // This node already exists in the tree. So patch up our parent to point at it
-    // and then free the duplicate.
-    if (node->parent) {
+    size_t last = --vector->bucket_ends[b];
+    if (last != hole) {
 
-      // Replace myself with the already existing node
-      node_replace_subnode(node->parent, node, *seen_node);
+      // The moved chunk becomes the first one of the bucket
+      chunk_vector_move(vector, last, hole);
+      size = last - hole;
+      vector->bucket_rots[b] = (vector->bucket_rots[b] + 1) % size;
 
     }
 
-    // We're a duplicate and not needed anymore, and neither are our subnodes!
-    node_free(node);
+    hole = last;
+
+  }
+
+  --vector->num_nodes;
+  vector->changed = true;
+
+  chunk_store_size -= CHUNK_INDEX_SIZE;
+  chunk_store_total_len -= len;
+  --chunk_store_num_chunks;
+  ++chunk_store_num_evictions;
+
+  chunk_store_release_node(node);
+
+}
+
+// Pick a random chunk to be evicted. Out of two random node types, the one
+// with more chunks is preferred, so that rare node types keep their chunks.
+// Chunks that are not shared by other chunks are preferred as well, because
+// evicting them actually frees memory.
+static void chunk_store_evict_random_chunk() {
+
+  chunk_vector_t *vector = NULL, *cur;
+  int             num_picked = 0;
+  for (int tries = 0; tries < 16 && num_picked < 2; ++tries) {
+
+    cur = &chunk_store[random_below(chunk_store_num_types)];
+    if (!cur->num_nodes) continue;
 
-  } else {
+    if (!vector || cur->num_nodes > vector->num_nodes) vector = cur;
+    ++num_picked;
 
-    // This is a brand new node, so keep it!
-    map_set(&seen_chunks, node_hash, node);
+  }
+
+  for (size_t id = 0; !vector && id < chunk_store_num_types; ++id) {
+
+    if (chunk_store[id].num_nodes) vector = &chunk_store[id];
+
+  }
+
+  if (unlikely(!vector)) return;
+
+  size_t i = random_below(vector->num_nodes);
+  for (int tries = 0; tries < 4 && vector->nodes_buf[i]->ref_count > 1;
+       ++tries) {
+
+    i = random_below(vector->num_nodes);
+
+  }
+
+  chunk_store_evict_chunk(vector, i);
+
+}
+
+static void chunk_store_index_node(node_t *node, hash_key_t hash, size_t len);
+
+// Evict chunks until the chunk store fits into its memory limit
+static void chunk_store_evict_to_fit() {
+
+  while (chunk_store_max_size && chunk_store_num_chunks &&
+         chunk_store_footprint() > chunk_store_max_size) {
+
+    chunk_store_evict_random_chunk();
+
+  }
+
+}
+
+/**
+ * Store the subtree bottom-up, so that the hash of each node is computed only
+ * once, from the hashes of its (already stored) subnodes.
+ * @param  node The node, which is owned by the chunk store after this call
+ * @param  hash The Merkle hash of the subtree
+ * @param  len  The length of the subtree (see `node_get_data_len`)
+ * @return      The stored node, which is an existing copy of `node` if `node`
+ *              is a duplicate (`node` itself is freed in this case)
+ */
+static node_t *chunk_store_intern_node(node_t *node, hash_key_t *hash,
+                                       size_t *len) {
+
+  hash_key_t node_hash = node_hash_self(node);
+  hash_key_t subnode_hash;
+  size_t     node_len = node->subnode_count ? 0 : node->val_len;
+  size_t     subnode_len;
+  for (uint32_t i = 0; i < node->subnode_count; ++i) {
+
+    // NOTE: We *don't* clone this subnode before handing off ownership.
+    //       If the subnode is a duplicate, then *this* node will point at
+    //       the already-seen copy, and the duplicate gets freed.
+    node->subnodes[i] = chunk_store_intern_node(node->subnodes[i],
+                                                &subnode_hash, &subnode_len);
+    node_hash = node_hash_combine(node_hash, subnode_hash);
+    node_len += subnode_len;
+
+  }
+
+  *hash = node_hash;
+  *len = node_len;
+  ++chunk_store_num_added_nodes;
+
+  node_t **seen_node = (node_t **)hash_table_get(&seen_chunks, node_hash);
+  if (seen_node) {
+
+    ++chunk_store_num_duplicates;
+
+    // We're a duplicate and not needed anymore. Our subnodes are shared with
+    // the chunk store now, so only free the node itself.
+    node_free_only_self(node);
+    return *seen_node;
+
+  }
+
+  // This is a brand new node, which shares its subnodes
+  for (uint32_t i = 0; i < node->subnode_count; ++i)
+    ++node->subnodes[i]->ref_count;
+
+  chunk_store_size += node_footprint(node);
+  chunk_store_index_node(node, node_hash, node_len);
+  return node;
+
+}
+
+// Make a stored node a chunk, which can be picked as a donor
+static void chunk_store_index_node(node_t *node, hash_key_t hash, size_t len) {
 
-    // NOTE: If this is a terminal node (node->id == 0), we *could*
-    // skip creating a list for them here, because they aren't usable
-    // for the splicing mutation (because they are not all interchangable).
-    // But for simplicity we can just leave it as-is for now.
+  // The node is owned by the array of its node type
+  ++node->ref_count;
 
-    list_t **p_node_list = map_get(&chunk_store, node_type);
-    if (unlikely(!p_node_list)) {
+  if (unlikely(!hash_table_set(&seen_chunks, hash, node))) {
 
-      map_set(&chunk_store, node_type, list_create());
-      p_node_list = map_get(&chunk_store, node_type);
+    perror("chunk store allocation (hash_table_set)");
+    exit(EXIT_FAILURE);
+
+  }
+
+  // NOTE: If this is a terminal node (node->id == 0), we *could*
+  // skip storing them here, because they aren't usable for the splicing
+  // mutation (because they are not all interchangable). But all stored
+  // nodes are freed via these arrays, so keep them for simplicity.
+
+  chunk_vector_t *vector = chunk_store_get_vector(node->id);
+  if (unlikely(!vector ||
+               !maybe_grow((void **)&vector->nodes_buf, &vector->nodes_size,
+                           (vector->num_nodes + 1) * sizeof(node_t *)) ||
+               !maybe_grow((void **)&vector->hashes_buf, &vector->hashes_size,
+                           (vector->num_nodes + 1) * sizeof(hash_key_t)) ||
+               !maybe_grow((void **)&vector->lens_buf, &vector->lens_size,
+                           (vector->num_nodes + 1) * sizeof(size_t)))) {
+
+    perror("chunk store allocation (maybe_grow)");
+    exit(EXIT_FAILURE);
+
+  }
+
+  // Make room at the end of the bucket, by moving the first chunk of each
+  // following bucket to the end of that bucket
+  uint32_t bucket = chunk_store_bucket(len);
+  size_t   hole = vector->num_nodes;
+  for (uint32_t b = CHUNK_STORE_NUM_BUCKETS - 1; b > bucket; --b) {
+
+    size_t first = vector->bucket_ends[b - 1];
+    if (first != hole) {
+
+      // The moved chunk becomes the last one of the bucket
+      chunk_vector_move(vector, first, hole);
+      size_t size = hole - first;
+      vector->bucket_rots[b] = (vector->bucket_rots[b] + size - 1) % size;
 
     }
 
-    list_t *node_list = *p_node_list;
-    list_append(node_list, node);
+    hole = first;
+    ++vector->bucket_ends[b];
 
-    // process subnodes
-    node_t *subnode = NULL;
-    for (uint32_t i = 0; i < node->subnode_count; ++i) {
+  }
 
-      subnode = node->subnodes[i];
+  // The hole is between the longest and the shortest chunks of the ring, and
+  // then moves to the sorted position of the new chunk
+  ++vector->bucket_ends[bucket];
+  size_t size = vector->bucket_ends[bucket] - chunk_bucket_start(vector, bucket);
+  size_t pos = size - 1 - vector->bucket_rots[bucket];
+  size_t to = chunk_bucket_search(vector, bucket, size, 0, pos, len, true);
+  if (to == pos)
+    to = chunk_bucket_search(vector, bucket, size, pos + 1, size, len, false) -
+         1;
+
+  chunk_bucket_move_hole(vector, bucket, size, pos, to);
+  hole = chunk_bucket_index(vector, bucket, size, to);
+
+  vector->nodes_buf[hole] = node;
+  vector->hashes_buf[hole] = hash;
+  vector->lens_buf[hole] = len;
+  ++vector->num_nodes;
+  vector->changed = true;
+
+  chunk_store_size += CHUNK_INDEX_SIZE;
+  chunk_store_total_len += len;
+  ++chunk_store_num_chunks;
+
+}
+
+/**
+ * Take ownership of a node for the chunk store, storing it if unique or freeing it if not.
+ * @param  node The node, which must not be owned/kept by anybody else. It also should not have a parent except when called recursively.
+ */
+void chunk_store_take_node(node_t *node) {
+
+  if (!node) return;
 
-      // NOTE: We *don't* clone this subnode before handing off ownership.
-      //       If the subnode is a duplicate, then it will patch up *this* node
-      //       to point at the already-seen copy and then free the duplicate.
-      chunk_store_take_node(subnode);
+  uint64_t   start_time = chunk_store_time_us();
+  node_t *   parent = node->parent;
+  hash_key_t hash;
+  size_t     len;
+  node_t *   stored_node = chunk_store_intern_node(node, &hash, &len);
+  if (stored_node != node && parent) {
+
+    // This node already exists in the store. So patch up our parent to point
+    // at it.
+    for (uint32_t i = 0; i < parent->subnode_count; ++i) {
+
+      if (parent->subnodes[i] == node) parent->subnodes[i] = stored_node;
 
     }
 
   }
 
+  // NOTE: Evict only after the whole subtree has been stored, because nodes
+  //       of this subtree may be shared by the nodes that are being stored.
+  chunk_store_evict_to_fit();
+
+  ++chunk_store_num_added_trees;
+  chunk_store_insert_time_us += chunk_store_time_us() - start_time;
+
+}
+
+void chunk_store_init(size_t max_size) {
+
+  chunk_store_stop_worker();
+
+  chunk_store = NULL;
+  chunk_store_num_types = 0;
+  hash_table_init(&seen_chunks, 0);
+
+  chunk_store_size = 0;
+  chunk_store_max_size = max_size;
+  chunk_store_num_chunks = 0;
+  chunk_store_num_evictions = 0;
+
+  chunk_store_total_len = 0;
+  chunk_store_num_added_trees = 0;
+  chunk_store_num_added_nodes = 0;
+  chunk_store_num_duplicates = 0;
+  chunk_store_insert_time_us = 0;
+  chunk_store_num_lookups = 0;
+  chunk_store_num_misses = 0;
+
 }
 
-void chunk_store_init() {
+bool chunk_store_share(const char *path, size_t size) {
 
-  map_init(&chunk_store);
-  map_init(&seen_chunks);
+  return shared_chunk_store_open(path, size, CHUNK_STORE_NUM_NODE_TYPES,
+                                 GEN_GRAMMAR_HASH);
 
 }
 
@@ -164,6 +552,22 @@ void chunk_store_add_tree(tree_t *tree) {
 
   if (!tree || !tree->root) return;
 
+  // The shared chunk store copies the subtrees into the file
+  if (shared_chunk_store_is_open()) {
+
+    shared_chunk_store_add_node(tree->root);
+    return;
+
+  }
+
+  // The worker stores a snapshot of the tree later
+  if (chunk_store_worker_is_running()) {
+
+    chunk_store_worker_add_node(tree->root);
+    return;
+
+  }
+
   // Clone the tree and then hand it off to the chunk_store
   chunk_store_take_node(node_clone(tree->root));
 
@@ -171,35 +575,543 @@ void chunk_store_add_tree(tree_t *tree) {
 
 node_t *chunk_store_get_alternative_node(node_t *node) {
 
+  return chunk_store_get_alternative_node_within(node, SIZE_MAX);
+
+}
+
+node_t *chunk_store_get_alternative_node_within(node_t *node, size_t max_len) {
+
   if (!node) return NULL;
 
-  const char *node_type = node_type_str(node->id);
-  list_t **   p_node_list = map_get(&chunk_store, node_type);
-  if (unlikely(!p_node_list)) return NULL;
+  node_t *alternative_node = NULL;
+  if (shared_chunk_store_is_open()) {
+
+    alternative_node = shared_chunk_store_get_node(node->id, max_len);
+
+  } else if (chunk_store_worker_is_running()) {
+
+    // Chunks of the worker are picked from its published arrays
+    alternative_node = chunk_store_worker_get_node(node->id, max_len);
+
+  } else if (likely(node->id < chunk_store_num_types)) {
+
+    // Stored nodes are never modified, so the node is shared instead of cloned
+    alternative_node =
+        node_share(chunk_vector_pick(&chunk_store[node->id], max_len));
+
+  }
+
+  // Only the mutator requests alternative nodes, so the counts are not locked
+  ++chunk_store_num_lookups;
+  if (!alternative_node) ++chunk_store_num_misses;
+  return alternative_node;
+
+}
+
+// Pick a random chunk of the array that is not longer than `max_len` bytes
+node_t *chunk_vector_pick(chunk_vector_t *vector, size_t max_len) {
+
+  // Chunks in buckets before `bucket` are short enough, and so are the
+  // shortest ones in `bucket`
+  uint32_t bucket = chunk_store_bucket(max_len);
+  size_t   num_short = chunk_bucket_start(vector, bucket);
+  size_t   size = vector->bucket_ends[bucket] - num_short;
+  size_t   num_candidates =
+      num_short + chunk_bucket_search(vector, bucket, size, 0, size, max_len,
+                                      true);
+  if (unlikely(!num_candidates)) return NULL;
+
+  size_t i = random_below(num_candidates);
+  if (i >= num_short)
+    i = chunk_bucket_index(vector, bucket, size, i - num_short);
+
+  return vector->nodes_buf[i];
+
+}
+
+typedef struct chunk_store_snapshot_writer {
+
+  FILE *   f;
+  uint64_t num_records;
+  uint64_t records_size;
+
+  // The index of each written node (keyed by its address), plus one
+  hash_table_t written;
+
+  // The hash of each written node
+  BUF_VAR(hash_key_t, hashes);
+
+} chunk_store_snapshot_writer_t;
+
+static inline hash_key_t node_address_key(node_t *node) {
+
+  uint64_t address = (uint64_t)(uintptr_t)node;
+  return (hash_key_t){address * 0x9e3779b97f4a7c15, address};
+
+}
+
+// Write the node after its subnodes, and return its index (or -1 on errors)
+static int64_t chunk_store_write_node(chunk_store_snapshot_writer_t *writer,
+                                      node_t *                       node) {
+
+  void **written = hash_table_get(&writer->written, node_address_key(node));
+  if (written) return (int64_t)(uintptr_t)*written - 1;
+
+  chunk_store_snapshot_record_t record = {.hash = node_hash_self(node),
+                                          .id = node->id,
+                                          .rule_id = node->rule_id,
+                                          .val_len = node->val_len,
+                                          .subnode_count = node->subnode_count};
+
+  uint32_t  stack_subnodes[16];
+  uint32_t *subnodes = stack_subnodes;
+  int64_t   index = -1;
+  if (node->subnode_count > 16) {
+
+    subnodes = malloc(node->subnode_count * sizeof(uint32_t));
+    if (unlikely(!subnodes)) return -1;
+
+  }
+
+  for (uint32_t i = 0; i < node->subnode_count; ++i) {
+
+    int64_t subnode_index = chunk_store_write_node(writer, node->subnodes[i]);
+    if (subnode_index < 0) goto out;
+
+    subnodes[i] = subnode_index;
+    record.hash =
+        node_hash_combine(record.hash, writer->hashes_buf[subnode_index]);
+
+  }
+
+  size_t   size = sizeof(record) + node->subnode_count * sizeof(uint32_t) +
+                node->val_len;
+  uint64_t padding = 0;
+  size_t   padding_len = ((size + 7) & ~(size_t)7) - size;
+  if (fwrite(&record, sizeof(record), 1, writer->f) != 1 ||
+      fwrite(subnodes, sizeof(uint32_t), node->subnode_count, writer->f) !=
+          node->subnode_count ||
+      (node->val_len &&
+       fwrite(node->val_buf, 1, node->val_len, writer->f) != node->val_len) ||
+      fwrite(&padding, 1, padding_len, writer->f) != padding_len)
+    goto out;
+
+  if (unlikely(
+          !maybe_grow((void **)&writer->hashes_buf, &writer->hashes_size,
+                      (writer->num_records + 1) * sizeof(hash_key_t)) ||
+          !hash_table_set(&writer->written, node_address_key(node),
+                          (void *)(uintptr_t)(writer->num_records + 1))))
+    goto out;
+
+  writer->hashes_buf[writer->num_records] = record.hash;
+  writer->records_size += size + padding_len;
+  index = writer->num_records++;
+
+out:
+  if (subnodes != stack_subnodes) free(subnodes);
+  return index;
+
+}
+
+bool chunk_store_save(const char *path) {
+
+  if (shared_chunk_store_is_open()) return false;  // persistent already
+
+  // Write to a temporary file at first, so that a crash never leaves a
+  // partially written snapshot
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, PATH_MAX, "%s.%d", path, (int)getpid());
+  FILE *f = fopen(tmp_path, "wb");
+  if (!f) {
+
+    perror("Cannot create the snapshot of the chunk store");
+    return false;
+
+  }
+
+  // The worker must not change the chunks while they are written
+  chunk_store_lock();
+
+  bool                          ret = false;
+  chunk_store_snapshot_writer_t writer = {.f = f};
+  chunk_store_snapshot_header_t header = {
+      .magic = CHUNK_STORE_SNAPSHOT_MAGIC,
+      .version = CHUNK_STORE_SNAPSHOT_VERSION,
+      .num_types = CHUNK_STORE_NUM_NODE_TYPES,
+      .grammar_hash = GEN_GRAMMAR_HASH,
+      .num_chunks = chunk_store_num_chunks};
+  if (!hash_table_init(&writer.written, 0)) goto out;
+
+  // The header is written again at the end, with the number of records
+  if (fwrite(&header, sizeof(header), 1, f) != 1) goto out;
+
+  for (size_t id = 0; id < chunk_store_num_types; ++id) {
+
+    for (size_t i = 0; i < chunk_store[id].num_nodes; ++i)
+      if (chunk_store_write_node(&writer, chunk_store[id].nodes_buf[i]) < 0)
+        goto out;
+
+  }
+
+  for (size_t id = 0; id < chunk_store_num_types; ++id) {
+
+    for (size_t i = 0; i < chunk_store[id].num_nodes; ++i) {
+
+      uint32_t index = (uint32_t)(uintptr_t)*hash_table_get(
+                           &writer.written,
+                           node_address_key(chunk_store[id].nodes_buf[i])) -
+                       1;
+      if (fwrite(&index, sizeof(index), 1, f) != 1) goto out;
+
+    }
+
+  }
+
+  header.num_records = writer.num_records;
+  header.records_size = writer.records_size;
+  if (fseek(f, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, f) != 1)
+    goto out;
+
+  ret = true;
+
+out:
+  chunk_store_unlock();
+  if (fclose(f) != 0) ret = false;
+  if (ret && rename(tmp_path, path) != 0) ret = false;
+  if (!ret) {
+
+    perror("Cannot write the snapshot of the chunk store");
+    unlink(tmp_path);
+
+  }
+
+  hash_table_deinit(&writer.written);
+  free(writer.hashes_buf);
+  return ret;
+
+}
+
+// Create the nodes of the snapshot records, which are merged with the nodes
+// that have been stored already
+static bool chunk_store_load_records(const uint8_t *buf, size_t size,
+                                     uint64_t num_records, node_t **nodes,
+                                     hash_key_t *hashes, size_t *lens,
+                                     bool *created) {
+
+  size_t offset = 0;
+  for (uint64_t i = 0; i < num_records; ++i) {
+
+    const chunk_store_snapshot_record_t *record =
+        (const chunk_store_snapshot_record_t *)(buf + offset);
+    if (offset + sizeof(*record) > size) return false;
+
+    const uint32_t *subnodes = (const uint32_t *)(record + 1);
+    const uint8_t * val_buf = (const uint8_t *)(subnodes + record->subnode_count);
+    size_t          record_size = val_buf + record->val_len - (buf + offset);
+    record_size = (record_size + 7) & ~(size_t)7;
+    if (offset + record_size > size) return false;
+    offset += record_size;
+
+    // Reject nodes that do not exist in the grammar, and subnodes that are
+    // not written before their parents
+    if (record->id >= CHUNK_STORE_NUM_NODE_TYPES) return false;
+    if (record->id ? record->rule_id >= node_num_rules[record->id]
+                   : record->rule_id || record->subnode_count)
+      return false;
+
+    for (uint32_t j = 0; j < record->subnode_count; ++j)
+      if (subnodes[j] >= i) return false;
+
+    hashes[i] = record->hash;
+    lens[i] = record->subnode_count ? 0 : record->val_len;
+    for (uint32_t j = 0; j < record->subnode_count; ++j)
+      lens[i] += lens[subnodes[j]];
+
+    node_t **seen_node = (node_t **)hash_table_get(&seen_chunks, record->hash);
+    if (seen_node) {
+
+      nodes[i] = *seen_node;
+      continue;
 
-  list_t *node_list = *p_node_list;
-  size_t  n = node_list->size;
-  int     prob = random_below(n);
-  // must clone the node
-  return node_clone((node_t *)list_get(node_list, prob));
+    }
+
+    node_t *node = node_create_with_rule_id(record->id, record->rule_id);
+    node_set_val(node, val_buf, record->val_len);
+    node->val_len = record->val_len;
+    if (record->subnode_count) {
+
+      node_init_subnodes(node, record->subnode_count);
+      for (uint32_t j = 0; j < record->subnode_count; ++j) {
+
+        node_set_subnode(node, j, nodes[subnodes[j]]);
+        ++nodes[subnodes[j]]->ref_count;
+
+      }
+
+    }
+
+    chunk_store_size += node_footprint(node);
+    nodes[i] = node;
+    created[i] = true;
+
+  }
+
+  return true;
+
+}
+
+bool chunk_store_load(const char *path) {
+
+  if (shared_chunk_store_is_open()) return false;  // persistent already
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;  // may not exist
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (size_t)info.st_size < sizeof(chunk_store_snapshot_header_t)) {
+
+    close(fd);
+    return false;
+
+  }
+
+  size_t   size = info.st_size;
+  uint8_t *buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (buf == MAP_FAILED) {
+
+    perror("Cannot map the snapshot of the chunk store to the memory");
+    return false;
+
+  }
+
+  bool                           ret = false;
+  chunk_store_snapshot_header_t *header = (chunk_store_snapshot_header_t *)buf;
+  node_t **                      nodes = NULL;
+  hash_key_t *                   hashes = NULL;
+  size_t *                       lens = NULL;
+  bool *                         created = NULL;
+  uint64_t                       num_records = header->num_records;
+  if (header->magic != CHUNK_STORE_SNAPSHOT_MAGIC ||
+      header->version != CHUNK_STORE_SNAPSHOT_VERSION ||
+      header->num_types != CHUNK_STORE_NUM_NODE_TYPES ||
+      header->grammar_hash != GEN_GRAMMAR_HASH ||
+      header->records_size > size || header->num_chunks > size ||
+      sizeof(*header) + header->records_size +
+              header->num_chunks * sizeof(uint32_t) !=
+          size) {
+
+    fprintf(stderr, "%s is not a chunk store snapshot of this grammar\n",
+            path);
+    goto out;
+
+  }
+
+  nodes = malloc(num_records * sizeof(node_t *));
+  hashes = malloc(num_records * sizeof(hash_key_t));
+  lens = malloc(num_records * sizeof(size_t));
+  created = calloc(num_records, sizeof(bool));
+  if (unlikely(num_records && (!nodes || !hashes || !lens || !created))) {
+
+    perror("chunk store snapshot allocation (malloc)");
+    goto out;
+
+  }
+
+  chunk_store_lock();
+  bool loaded = chunk_store_load_records(buf + sizeof(*header),
+                                         header->records_size, num_records,
+                                         nodes, hashes, lens, created);
+
+  // Make chunks of the nodes, unless they have been chunks already
+  const uint32_t *chunks =
+      (const uint32_t *)(buf + sizeof(*header) + header->records_size);
+  for (uint64_t i = 0; loaded && i < header->num_chunks; ++i) {
+
+    uint32_t index = chunks[i];
+    if (index >= num_records) {
+
+      loaded = false;
+      break;
+
+    }
+    if (!created[index] || hash_table_get(&seen_chunks, hashes[index]))
+      continue;
+
+    chunk_store_index_node(nodes[index], hashes[index], lens[index]);
+
+  }
+
+  // Free the nodes that are not used, e.g., because their parents have been
+  // stored already. Parents come after their subnodes, so that a subnode is
+  // visited after all its parents.
+  for (uint64_t i = num_records; i-- > 0;) {
+
+    if (!created[i] || nodes[i]->ref_count) continue;
+
+    for (uint32_t j = 0; j < nodes[i]->subnode_count; ++j)
+      --nodes[i]->subnodes[j]->ref_count;
+
+    chunk_store_size -= node_footprint(nodes[i]);
+    node_free_only_self(nodes[i]);
+
+  }
+
+  chunk_store_evict_to_fit();
+  if (chunk_store_worker_is_running()) chunk_store_publish();
+  chunk_store_unlock();
+  ret = loaded;
+
+out:
+  free(nodes);
+  free(hashes);
+  free(lens);
+  free(created);
+  munmap(buf, size);
+  return ret;
+
+}
+
+void chunk_store_get_stats(chunk_store_stats_t *stats) {
+
+  chunk_store_lock();
+  stats->num_chunks = chunk_store_num_chunks;
+  stats->size = chunk_store_footprint();
+  stats->num_evictions = chunk_store_num_evictions;
+  stats->total_len = chunk_store_total_len;
+  stats->num_added_trees = chunk_store_num_added_trees;
+  stats->num_added_nodes = chunk_store_num_added_nodes;
+  stats->num_duplicates = chunk_store_num_duplicates;
+  stats->insert_time_us = chunk_store_insert_time_us;
+  chunk_store_unlock();
+
+  stats->num_lookups = chunk_store_num_lookups;
+  stats->num_misses = chunk_store_num_misses;
+  stats->num_queued = stats->num_dropped = stats->num_full = 0;
+  if (chunk_store_worker_is_running())
+    chunk_store_worker_get_stats(&stats->num_queued, &stats->num_dropped);
+
+  // Trees are copied into the shared chunk store without these statistics
+  if (shared_chunk_store_is_open()) {
+
+    stats->num_chunks = shared_chunk_store_get_num_chunks();
+    stats->size = shared_chunk_store_get_size();
+    stats->num_full = shared_chunk_store_get_num_full();
+
+  }
+
+}
+
+void chunk_store_get_type_stats(size_t *num_chunks, size_t num_types) {
+
+  if (shared_chunk_store_is_open()) {
+
+    for (size_t id = 0; id < num_types; ++id)
+      num_chunks[id] = shared_chunk_store_get_num_chunks_of_type(id);
+    return;
+
+  }
+
+  chunk_store_lock();
+  for (size_t id = 0; id < num_types; ++id)
+    num_chunks[id] = id < chunk_store_num_types ? chunk_store[id].num_nodes : 0;
+  chunk_store_unlock();
+
+}
+
+bool chunk_store_write_stats(const char *path) {
+
+  chunk_store_stats_t stats;
+  size_t              num_chunks[CHUNK_STORE_NUM_NODE_TYPES];
+  chunk_store_get_stats(&stats);
+  chunk_store_get_type_stats(num_chunks, CHUNK_STORE_NUM_NODE_TYPES);
+
+  // Write to a temporary file at first, so that readers never see a partially
+  // written file
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, PATH_MAX, "%s.%d", path, (int)getpid());
+  FILE *f = fopen(tmp_path, "w");
+  if (!f) {
+
+    perror("Cannot create the statistics file of the chunk store");
+    return false;
+
+  }
+
+  fprintf(f, "last_update       : %llu\n", (unsigned long long)time(NULL));
+  fprintf(f, "chunks            : %zu\n", stats.num_chunks);
+  fprintf(f, "bytes             : %zu\n", stats.size);
+  fprintf(f, "max_bytes         : %zu\n", chunk_store_max_size);
+  fprintf(f, "evictions         : %zu\n", stats.num_evictions);
+  fprintf(f, "avg_chunk_len     : %.02f\n",
+          stats.num_chunks ? (double)stats.total_len / stats.num_chunks : 0.0);
+  fprintf(f, "stored_trees      : %zu\n", stats.num_added_trees);
+  fprintf(f, "stored_subtrees   : %zu\n", stats.num_added_nodes);
+  fprintf(f, "dedup_hit_rate    : %.02f%%\n",
+          stats.num_added_nodes
+              ? 100.0 * stats.num_duplicates / stats.num_added_nodes
+              : 0.0);
+  fprintf(f, "avg_insert_us     : %.02f\n",
+          stats.num_added_trees
+              ? (double)stats.insert_time_us / stats.num_added_trees
+              : 0.0);
+  fprintf(f, "queued_trees      : %zu\n", stats.num_queued);
+  fprintf(f, "dropped_trees     : %zu\n", stats.num_dropped);
+  fprintf(f, "shared_full_trees : %zu\n", stats.num_full);
+  fprintf(f, "splice_lookups    : %zu\n", stats.num_lookups);
+  fprintf(f, "splice_misses     : %zu\n", stats.num_misses);
+  fprintf(f, "splice_miss_rate  : %.02f%%\n",
+          stats.num_lookups ? 100.0 * stats.num_misses / stats.num_lookups
+                            : 0.0);
+
+  // Chunks per node type, e.g., `chunks_NODE_VALUE`
+  for (size_t id = 0; id < CHUNK_STORE_NUM_NODE_TYPES; ++id)
+    fprintf(f, "chunks_%-11s : %zu\n", node_type_str(id), num_chunks[id]);
+
+  bool ret = !ferror(f);
+  if (fclose(f) != 0) ret = false;
+  if (ret && rename(tmp_path, path) != 0) ret = false;
+  if (!ret) {
+
+    perror("Cannot write the statistics file of the chunk store");
+    unlink(tmp_path);
+
+  }
+
+  return ret;
 
 }
 
 void chunk_store_clear() {
 
-  map_deinit(&seen_chunks);
+  chunk_store_stop_worker();
 
-  const char *key;
-  map_iter_t  iter = map_iter(&list_map);
-  while ((key = map_next(&chunk_store, &iter))) {
+  hash_table_deinit(&seen_chunks);
 
-    // NOTE: This needs to only free the CURRENT node and not its children, because we know that the
-    //       chunk store map already contains all the children and they will get freed as well!
-    list_free_with_data_free_func(*map_get(&chunk_store, key),
-                                  (data_free_t)node_free_only_self);
+  for (size_t id = 0; id < chunk_store_num_types; ++id) {
+
+    chunk_vector_t *vector = &chunk_store[id];
+
+    // NOTE: Shared subnodes are freed together with the last chunk that
+    //       uses them, which may have been evicted from the arrays already
+    for (size_t i = 0; i < vector->num_nodes; ++i)
+      chunk_store_release_node(vector->nodes_buf[i]);
+
+    free(vector->nodes_buf);
+    free(vector->hashes_buf);
+    free(vector->lens_buf);
 
   }
 
-  map_deinit(&chunk_store);
+  free(chunk_store);
+  chunk_store = NULL;
+  chunk_store_num_types = 0;
+
+  chunk_store_size = 0;
+  chunk_store_num_chunks = 0;
+  chunk_store_total_len = 0;
+
+  shared_chunk_store_close();
 
 }
@@ -19,27 +19,115 @@
 #ifndef __CHUNK_STORE_INTERNAL_H__
 #define __CHUNK_STORE_INTERNAL_H__
 
-#include "map.h"
+#include "hash_table.h"
 #include "tree.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// Map of lists of chunks, one list for each node type
-typedef map_t(list_t *) list_map_t;
-extern list_map_t chunk_store;
+// Chunks of a node type are grouped by the bit width of their lengths
+#define CHUNK_STORE_NUM_BUCKETS (32)
 
-// Map of node hashes to pointers to stored nodes
+// A growable array of chunks of one node type
+typedef struct chunk_vector {
+
+  BUF_VAR(node_t *, nodes);
+  BUF_VAR(hash_key_t, hashes);  // the hash of each chunk in `nodes`
+  BUF_VAR(size_t, lens);        // the length of each chunk in `nodes`
+  size_t num_nodes;
+
+  // Chunks in bucket `i` are stored in `nodes[bucket_ends[i - 1]]` to
+  // `nodes[bucket_ends[i] - 1]`, so shorter chunks come first
+  size_t bucket_ends[CHUNK_STORE_NUM_BUCKETS];
+
+  // Chunks of a bucket are sorted by their lengths as a ring: the shortest
+  // one is `bucket_rots[i]` slots after the start of bucket `i`, and the
+  // order wraps around at its end. Hence, moving a chunk from one end of a
+  // bucket to the other keeps the bucket sorted.
+  size_t bucket_rots[CHUNK_STORE_NUM_BUCKETS];
+
+  // Whether chunks have been added or evicted since the last publication
+  bool changed;
+
+} chunk_vector_t;
+
+// Arrays of chunks, indexed by the node type (i.e., `node->id`)
+extern chunk_vector_t *chunk_store;
+extern size_t          chunk_store_num_types;
+
+// Table of node hashes to pointers to stored nodes
 // in the chunk_store. This can quickly identify if
 // a node already exists in the chunk_store, by searching
-// this map for an existing hash.
-typedef map_t(node_t *) node_map_t;
-extern node_map_t seen_chunks;
+// this table for an existing hash.
+extern hash_table_t seen_chunks;
+
+/*
+ * A snapshot of the chunk store contains all stored nodes, in the order of a
+ * post-order traversal, followed by the indexes of the nodes that are chunks:
+ *
+ *   header | node records | chunk indexes
+ *
+ * A node record refers to its subnodes by their indexes, so that loading a
+ * snapshot neither clones nor hashes any subtree.
+ */
+
+#define CHUNK_STORE_SNAPSHOT_MAGIC (0x544f4853504e4e43)  // "CNNPSHOT"
+#define CHUNK_STORE_SNAPSHOT_VERSION (2)
+
+typedef struct chunk_store_snapshot_header {
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t num_types;
+  uint64_t grammar_hash;  // `GEN_GRAMMAR_HASH`
+  uint64_t num_records;
+  uint64_t num_chunks;
+  uint64_t records_size;
+
+} chunk_store_snapshot_header_t;
+
+// A stored node, which is followed by the indexes of its subnodes (`uint32_t`)
+// and its value, and then padded to 8 bytes
+typedef struct chunk_store_snapshot_record {
+
+  hash_key_t hash;
+  uint32_t   id;
+  uint32_t   rule_id;
+  uint32_t   val_len;
+  uint32_t   subnode_count;
+
+} chunk_store_snapshot_record_t;
 
 // private functions
-void   hash_node(node_t *node, char dest[16+1]);
-void   chunk_store_take_node(node_t *node);
+hash_key_t hash_node(node_t *node);
+hash_key_t node_hash_self(node_t *node);
+hash_key_t node_hash_combine(hash_key_t hash, hash_key_t subnode_hash);
+void       chunk_store_take_node(node_t *node);
+node_t *   chunk_vector_pick(chunk_vector_t *vector, size_t max_len);
+
+// The background worker of the chunk store (chunk_store_worker.c)
+bool    chunk_store_worker_is_running();
+void    chunk_store_worker_add_node(node_t *node);
+void    chunk_store_worker_get_stats(size_t *queued, size_t *dropped);
+node_t *chunk_store_worker_get_node(uint32_t id, size_t max_len);
+void    chunk_store_stop_worker();
+void    chunk_store_lock();
+void    chunk_store_unlock();
+void    chunk_store_publish();
+void    chunk_store_retire_node(node_t *node);
+
+// The shared chunk store, in a memory-mapped file (chunk_store_shared.c)
+bool    shared_chunk_store_open(const char *path, size_t size,
+                                uint32_t num_types, uint64_t grammar_hash);
+bool    shared_chunk_store_is_open();
+void    shared_chunk_store_add_node(node_t *node);
+node_t *shared_chunk_store_get_node(uint32_t id, size_t max_len);
+size_t  shared_chunk_store_get_num_chunks();
+size_t  shared_chunk_store_get_num_full();
+size_t  shared_chunk_store_get_num_chunks_of_type(uint32_t id);
+size_t  shared_chunk_store_get_size();
+void    shared_chunk_store_close();
 
 #ifdef __cplusplus
 }
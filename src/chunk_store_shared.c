@@ -0,0 +1,461 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk_store_internal.h"
+#include "utils.h"
+
+/*
+ * The shared chunk store is a single file, which is mapped into the memory of
+ * all fuzzer instances on the same machine:
+ *
+ *   header | hash table | per-type indexes | chunks
+ *
+ * Chunks are only appended, and they refer to each other by their offsets in
+ * the file, so the same subtree is stored once for all instances. All updates
+ * are lock-free:
+ * - A chunk is written into the space reserved by bumping `data_used`, and is
+ *   published by a compare-and-swap of an empty slot of the hash table.
+ * - The index of a node type is an array of chunk offsets. Once it is full, a
+ *   new chunk replaces a random one (reservoir sampling).
+ *
+ * Space is never reclaimed, as any chunk may be referenced by others. Once the
+ * hash table is 75% full or the chunks fill the file, new trees are not stored
+ * anymore (`num_full`), while the stored chunks can still be picked.
+ */
+
+#define SHARED_CHUNK_STORE_MAGIC (0x4b4e484352414853)  // "SHARCHNK"
+#define SHARED_CHUNK_STORE_VERSION (3)
+#define SHARED_CHUNK_STORE_HEADER_SIZE (4096)
+
+typedef struct shared_chunk_store_header {
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t num_types;
+  uint64_t size;
+  uint64_t grammar_hash;
+
+  uint64_t table_offset;
+  uint64_t table_slots;  // always a power of two
+  uint64_t index_offset;
+  uint64_t index_slots;  // per node type
+  uint64_t data_offset;
+
+  // Updated atomically by all instances
+  uint64_t data_used;
+  uint64_t num_chunks;
+  uint64_t num_full;  // trees that are not stored, as the file is full
+
+} shared_chunk_store_header_t;
+
+// A stored subtree, which is followed by its value
+typedef struct shared_chunk {
+
+  hash_key_t hash;
+  uint32_t   id;
+  uint32_t   rule_id;
+  uint32_t   val_len;
+  uint32_t   subnode_count;
+  uint64_t   data_len;    // the length of the subtree
+  uint64_t   subnodes[];  // offsets of the subnodes
+
+} shared_chunk_t;
+
+static uint8_t *                    shared_base = NULL;
+static shared_chunk_store_header_t *shared_header = NULL;
+
+static inline shared_chunk_t *shared_chunk_at(uint64_t offset) {
+
+  return (shared_chunk_t *)(shared_base + offset);
+
+}
+
+static inline uint64_t *shared_table() {
+
+  return (uint64_t *)(shared_base + shared_header->table_offset);
+
+}
+
+// The index of a node type: the number of added chunks, and then the offsets
+static inline uint64_t *shared_index(uint32_t id) {
+
+  return (uint64_t *)(shared_base + shared_header->index_offset) +
+         id * (shared_header->index_slots + 1);
+
+}
+
+static inline bool hash_key_equal(hash_key_t a, hash_key_t b) {
+
+  return a.low64 == b.low64 && a.high64 == b.high64;
+
+}
+
+// Split the file into the hash table, the indexes, and the chunks
+static bool shared_chunk_store_layout(shared_chunk_store_header_t *header,
+                                      size_t size, uint32_t num_types,
+                                      uint64_t grammar_hash) {
+
+  memset(header, 0, sizeof(shared_chunk_store_header_t));
+  header->magic = SHARED_CHUNK_STORE_MAGIC;
+  header->version = SHARED_CHUNK_STORE_VERSION;
+  header->num_types = num_types;
+  header->size = size;
+  header->grammar_hash = grammar_hash;
+
+  header->table_offset = SHARED_CHUNK_STORE_HEADER_SIZE;
+  header->table_slots = next_pow2(size / 512);
+  if (header->table_slots < 1024) header->table_slots = 1024;
+
+  header->index_offset =
+      header->table_offset + header->table_slots * sizeof(uint64_t);
+  header->index_slots = size / 16 / num_types / sizeof(uint64_t);
+  if (header->index_slots < 64) header->index_slots = 64;
+
+  header->data_offset = header->index_offset + num_types *
+                                                   (header->index_slots + 1) *
+                                                   sizeof(uint64_t);
+
+  // Most of the file should be left for the chunks
+  return header->data_offset <= size / 2;
+
+}
+
+bool shared_chunk_store_open(const char *path, size_t size,
+                             uint32_t num_types, uint64_t grammar_hash) {
+
+  if (shared_base) return true;
+
+  int fd = open(path, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+
+    perror("Cannot open the shared chunk store (shared_chunk_store_open)");
+    return false;
+
+  }
+
+  // Only one instance initializes the file
+  bool                        ret = false;
+  struct stat                 info;
+  shared_chunk_store_header_t header;
+  flock(fd, LOCK_EX);
+  if (fstat(fd, &info) != 0) {
+
+    perror("Cannot get file information (shared_chunk_store_open)");
+    goto out;
+
+  }
+
+  if (info.st_size == 0 ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+      header.magic == 0) {
+
+    // A new file, or the initialization has been interrupted
+    if (!shared_chunk_store_layout(&header, size, num_types,
+                                   grammar_hash)) {
+
+      fprintf(stderr, "The shared chunk store is too small\n");
+      goto out;
+
+    }
+
+    if (ftruncate(fd, size) != 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+
+      perror("Cannot initialize the shared chunk store");
+      goto out;
+
+    }
+
+    info.st_size = size;
+
+  }
+
+  if (header.magic != SHARED_CHUNK_STORE_MAGIC ||
+      header.version != SHARED_CHUNK_STORE_VERSION ||
+      header.num_types != num_types || header.grammar_hash != grammar_hash ||
+      header.size != (uint64_t)info.st_size) {
+
+    fprintf(stderr, "%s is not a shared chunk store of this grammar\n", path);
+    goto out;
+
+  }
+
+  uint8_t *base =
+      mmap(NULL, header.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) {
+
+    perror("Cannot map the shared chunk store to the memory");
+    goto out;
+
+  }
+
+  shared_base = base;
+  shared_header = (shared_chunk_store_header_t *)base;
+  ret = true;
+
+out:
+  flock(fd, LOCK_UN);
+  close(fd);
+  return ret;
+
+}
+
+bool shared_chunk_store_is_open() {
+
+  return shared_base != NULL;
+
+}
+
+// Add a new chunk to the index of its node type
+static void shared_chunk_store_index(uint32_t id, uint64_t offset) {
+
+  uint64_t *index = shared_index(id);
+  uint64_t  n = __atomic_fetch_add(&index[0], 1, __ATOMIC_RELAXED);
+  if (n >= shared_header->index_slots) {
+
+    n = random_below(n < UINT32_MAX ? n + 1 : UINT32_MAX);
+    if (n >= shared_header->index_slots) return;
+
+  }
+
+  __atomic_store_n(&index[1 + n], offset, __ATOMIC_RELEASE);
+
+}
+
+// Write a chunk into newly reserved space, and return its offset
+static uint64_t shared_chunk_store_append(node_t *node, hash_key_t hash,
+                                          uint64_t *subnodes) {
+
+  uint64_t data_len = node->subnode_count ? 0 : node->val_len;
+  for (uint32_t i = 0; i < node->subnode_count; ++i)
+    data_len += shared_chunk_at(subnodes[i])->data_len;
+
+
+  size_t size = sizeof(shared_chunk_t) +
+                node->subnode_count * sizeof(uint64_t) + node->val_len;
+  size = (size + 7) & ~(size_t)7;
+
+  uint64_t data_size = shared_header->size - shared_header->data_offset;
+  uint64_t used =
+      __atomic_fetch_add(&shared_header->data_used, size, __ATOMIC_RELAXED);
+  if (used + size > data_size) return 0;  // full
+
+  uint64_t        offset = shared_header->data_offset + used;
+  shared_chunk_t *chunk = shared_chunk_at(offset);
+  chunk->hash = hash;
+  chunk->id = node->id;
+  chunk->rule_id = node->rule_id;
+  chunk->val_len = node->val_len;
+  chunk->subnode_count = node->subnode_count;
+  chunk->data_len = data_len;
+  memcpy(chunk->subnodes, subnodes, node->subnode_count * sizeof(uint64_t));
+  if (node->val_len)
+    memcpy(&chunk->subnodes[node->subnode_count], node->val_buf,
+           node->val_len);
+  return offset;
+
+}
+
+/**
+ * Store the subtree bottom-up, like `chunk_store_intern_node`
+ * @param  node The node, which is not modified
+ * @param  hash The Merkle hash of the subtree
+ * @return      The offset of the stored chunk; otherwise, 0 if the shared
+ *              chunk store is full
+ */
+static uint64_t shared_chunk_store_intern(node_t *node, hash_key_t *hash) {
+
+  uint64_t   stack_subnodes[16];
+  uint64_t * subnodes = stack_subnodes;
+  uint64_t   offset = 0;
+  hash_key_t subnode_hash;
+
+  if (node->subnode_count > 16) {
+
+    subnodes = malloc(node->subnode_count * sizeof(uint64_t));
+    if (unlikely(!subnodes)) {
+
+      perror("shared chunk store allocation (malloc)");
+      return 0;
+
+    }
+
+  }
+
+  *hash = node_hash_self(node);
+  for (uint32_t i = 0; i < node->subnode_count; ++i) {
+
+    subnodes[i] = shared_chunk_store_intern(node->subnodes[i], &subnode_hash);
+    if (!subnodes[i]) goto out;
+    *hash = node_hash_combine(*hash, subnode_hash);
+
+  }
+
+  uint64_t *table = shared_table();
+  uint64_t  mask = shared_header->table_slots - 1;
+  uint64_t  new_offset = 0;
+  uint64_t  i = hash->low64 & mask;
+  for (uint64_t probes = 0; probes <= mask; ++probes, i = (i + 1) & mask) {
+
+    uint64_t cur = __atomic_load_n(&table[i], __ATOMIC_ACQUIRE);
+    if (!cur) {
+
+      // Keep the hash table sparse, so that probing stays short
+      if (__atomic_load_n(&shared_header->num_chunks, __ATOMIC_RELAXED) * 4 >=
+          shared_header->table_slots * 3)
+        goto out;
+
+      if (!new_offset) new_offset = shared_chunk_store_append(node, *hash,
+                                                              subnodes);
+      if (!new_offset) goto out;
+
+      if (__atomic_compare_exchange_n(&table[i], &cur, new_offset, false,
+                                      __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+
+        __atomic_add_fetch(&shared_header->num_chunks, 1, __ATOMIC_RELAXED);
+        shared_chunk_store_index(node->id, new_offset);
+        offset = new_offset;
+        goto out;
+
+      }
+
+      // Another instance has taken this slot, so check its chunk
+
+    }
+
+    if (hash_key_equal(shared_chunk_at(cur)->hash, *hash)) {
+
+      // NOTE: If another instance has just stored the same subtree, then our
+      //       copy (if any) is never referenced, which only wastes space
+      offset = cur;
+      goto out;
+
+    }
+
+  }
+
+out:
+  if (subnodes != stack_subnodes) free(subnodes);
+  return offset;
+
+}
+
+void shared_chunk_store_add_node(node_t *node) {
+
+  hash_key_t hash;
+  if (!shared_base || !node) return;
+
+  if (!shared_chunk_store_intern(node, &hash))
+    __atomic_add_fetch(&shared_header->num_full, 1, __ATOMIC_RELAXED);
+
+}
+
+// Create a tree from a stored chunk
+static node_t *shared_chunk_decode(uint64_t offset) {
+
+  shared_chunk_t *chunk = shared_chunk_at(offset);
+  node_t *        node = node_create_with_rule_id(chunk->id, chunk->rule_id);
+  node_set_val(node, &chunk->subnodes[chunk->subnode_count], chunk->val_len);
+  node->val_len = chunk->val_len;
+
+  if (chunk->subnode_count) {
+
+    node_init_subnodes(node, chunk->subnode_count);
+    for (uint32_t i = 0; i < chunk->subnode_count; ++i)
+      node_set_subnode(node, i, shared_chunk_decode(chunk->subnodes[i]));
+
+  }
+
+  return node;
+
+}
+
+node_t *shared_chunk_store_get_node(uint32_t id, size_t max_len) {
+
+  if (!shared_base || id >= shared_header->num_types) return NULL;
+
+  uint64_t *index = shared_index(id);
+  uint64_t  n = __atomic_load_n(&index[0], __ATOMIC_RELAXED);
+  if (!n) return NULL;
+  if (n > shared_header->index_slots) n = shared_header->index_slots;
+
+  // The index is not sorted, as it is updated by all instances without locks.
+  // Instead, a few chunks are checked before one of them is decoded.
+  for (int tries = 0; tries < 8; ++tries) {
+
+    // The slot may not be written yet, if another instance is adding a chunk
+    uint64_t offset =
+        __atomic_load_n(&index[1 + random_below(n)], __ATOMIC_ACQUIRE);
+    if (!offset) return NULL;
+
+    if (shared_chunk_at(offset)->data_len <= max_len)
+      return shared_chunk_decode(offset);
+
+  }
+
+  return NULL;
+
+}
+
+size_t shared_chunk_store_get_num_chunks() {
+
+  if (!shared_base) return 0;
+  return __atomic_load_n(&shared_header->num_chunks, __ATOMIC_RELAXED);
+
+}
+
+size_t shared_chunk_store_get_num_full() {
+
+  if (!shared_base) return 0;
+  return __atomic_load_n(&shared_header->num_full, __ATOMIC_RELAXED);
+
+}
+
+size_t shared_chunk_store_get_num_chunks_of_type(uint32_t id) {
+
+  if (!shared_base || id >= shared_header->num_types) return 0;
+  return __atomic_load_n(&shared_index(id)[0], __ATOMIC_RELAXED);
+
+}
+
+size_t shared_chunk_store_get_size() {
+
+  if (!shared_base) return 0;
+
+  uint64_t data_size = shared_header->size - shared_header->data_offset;
+  uint64_t used =
+      __atomic_load_n(&shared_header->data_used, __ATOMIC_RELAXED);
+  return shared_header->data_offset + (used < data_size ? used : data_size);
+
+}
+
+void shared_chunk_store_close() {
+
+  if (!shared_base) return;
+
+  munmap(shared_base, shared_header->size);
+  shared_base = NULL;
+  shared_header = NULL;
+
+}
@@ -0,0 +1,436 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "chunk_store.h"
+#include "chunk_store_internal.h"
+#include "utils.h"
+
+/*
+ * The worker moves the cloning, hashing, and indexing of added trees off the
+ * fuzzing loop:
+ * - `chunk_store_add_tree` only queues a shared (and hence immutable) root
+ *   node of the tree, and the worker stores a copy of it under the store lock.
+ * - Splicing never takes the lock. It picks chunks from a read-only view of
+ *   the arrays of `chunk_store`, which the worker replaces by a new view after
+ *   a batch of trees (read-copy-update). Arrays of node types without new or
+ *   evicted chunks are reused by the new view.
+ * - Old views, and evicted nodes that splicing may still be sharing, are freed
+ *   after a grace period, i.e., once no splicing reads any view.
+ */
+
+// The maximal number of queued trees, and of trees stored per publication
+#define CHUNK_STORE_WORKER_MAX_QUEUED (1024)
+#define CHUNK_STORE_WORKER_BATCH_SIZE (64)
+
+typedef struct chunk_store_view {
+
+  size_t           num_types;
+  chunk_vector_t **vectors;  // NULL if a node type has no chunks
+
+} chunk_store_view_t;
+
+static pthread_t      worker;
+static bool           worker_running = false;
+static random_state_t worker_random_state;
+
+// Protects the queue, the counts of trees, and `worker_stopping`
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  flushed_cond = PTHREAD_COND_INITIALIZER;
+static list_t *        queue = NULL;
+static size_t          num_pending = 0;  // queued or not yet published
+static size_t          num_dropped = 0;  // skipped, as the queue was full
+static bool            worker_stopping = false;
+
+// Protects the chunk store, and the retired nodes
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static node_t **retired_buf = NULL;
+static size_t   retired_size = 0;
+static size_t   num_retired = 0;
+
+// The published view, and the number of its readers
+static chunk_store_view_t *view = NULL;
+static size_t              num_readers = 0;
+
+void chunk_store_lock() {
+
+  pthread_mutex_lock(&store_lock);
+
+}
+
+void chunk_store_unlock() {
+
+  pthread_mutex_unlock(&store_lock);
+
+}
+
+bool chunk_store_worker_is_running() {
+
+  return worker_running;
+
+}
+
+// Copy a node, except for the fields that are computed by the mutator thread
+// (e.g., `non_term_size`), which may be written concurrently
+static node_t *chunk_store_copy_node(node_t *node) {
+
+  node_t *copy = node_create_with_rule_id(node->id, node->rule_id);
+  node_set_val(copy, node->val_buf, node->val_len);
+  copy->val_len = node->val_len;
+
+  if (node->subnode_count) {
+
+    node_init_subnodes(copy, node->subnode_count);
+    for (uint32_t i = 0; i < node->subnode_count; ++i)
+      node_set_subnode(copy, i, chunk_store_copy_node(node->subnodes[i]));
+
+  }
+
+  return copy;
+
+}
+
+// A read-only copy of the picked fields of an array (see `chunk_vector_pick`)
+static chunk_vector_t *chunk_vector_copy(chunk_vector_t *vector) {
+
+  if (!vector->num_nodes) return NULL;
+
+  chunk_vector_t *copy = calloc(1, sizeof(chunk_vector_t));
+  if (unlikely(!copy)) return NULL;
+
+  copy->nodes_buf = malloc(vector->num_nodes * sizeof(node_t *));
+  copy->lens_buf = malloc(vector->num_nodes * sizeof(size_t));
+  if (unlikely(!copy->nodes_buf || !copy->lens_buf)) {
+
+    free(copy->nodes_buf);
+    free(copy->lens_buf);
+    free(copy);
+    return NULL;
+
+  }
+
+  memcpy(copy->nodes_buf, vector->nodes_buf,
+         vector->num_nodes * sizeof(node_t *));
+  memcpy(copy->lens_buf, vector->lens_buf, vector->num_nodes * sizeof(size_t));
+  memcpy(copy->bucket_ends, vector->bucket_ends, sizeof(copy->bucket_ends));
+  memcpy(copy->bucket_rots, vector->bucket_rots, sizeof(copy->bucket_rots));
+  copy->num_nodes = vector->num_nodes;
+  return copy;
+
+}
+
+static void chunk_vector_free_copy(chunk_vector_t *copy) {
+
+  if (!copy) return;
+
+  free(copy->nodes_buf);
+  free(copy->lens_buf);
+  free(copy);
+
+}
+
+// Free a view, except for the arrays that are reused by `new_view` (if any)
+static void chunk_store_view_free(chunk_store_view_t *old_view,
+                                  chunk_store_view_t *new_view) {
+
+  if (!old_view) return;
+
+  for (size_t id = 0; id < old_view->num_types; ++id) {
+
+    if (new_view && id < new_view->num_types &&
+        new_view->vectors[id] == old_view->vectors[id])
+      continue;
+
+    chunk_vector_free_copy(old_view->vectors[id]);
+
+  }
+
+  free(old_view->vectors);
+  free(old_view);
+
+}
+
+// Free the retired nodes, which must not be read by splicing anymore
+static void chunk_store_free_retired_nodes() {
+
+  // NOTE: Subnodes are retired before their parents, and each of them has
+  //       been shared with its parent, so the parent (or a tree that uses the
+  //       parent) becomes the owner
+  for (size_t i = 0; i < num_retired; ++i)
+    node_free(retired_buf[i]);
+
+  num_retired = 0;
+
+}
+
+void chunk_store_retire_node(node_t *node) {
+
+  if (!worker_running) {
+
+    node_free(node);
+    return;
+
+  }
+
+  if (unlikely(!maybe_grow((void **)&retired_buf, &retired_size,
+                           (num_retired + 1) * sizeof(node_t *)))) {
+
+    perror("chunk store allocation (maybe_grow)");
+    exit(EXIT_FAILURE);
+
+  }
+
+  retired_buf[num_retired++] = node;
+
+}
+
+void chunk_store_publish() {
+
+  chunk_store_view_t *old_view = view;
+  chunk_store_view_t *new_view = calloc(1, sizeof(chunk_store_view_t));
+  if (unlikely(!new_view)) goto fail;
+
+  new_view->num_types = chunk_store_num_types;
+  new_view->vectors = calloc(chunk_store_num_types, sizeof(chunk_vector_t *));
+  if (unlikely(chunk_store_num_types && !new_view->vectors)) goto fail;
+
+  for (size_t id = 0; id < chunk_store_num_types; ++id) {
+
+    chunk_vector_t *vector = &chunk_store[id];
+    if (old_view && id < old_view->num_types && !vector->changed) {
+
+      // Unchanged arrays are reused by the new view
+      new_view->vectors[id] = old_view->vectors[id];
+      continue;
+
+    }
+
+    new_view->vectors[id] = chunk_vector_copy(vector);
+    if (unlikely(vector->num_nodes && !new_view->vectors[id])) goto fail;
+    vector->changed = false;
+
+  }
+
+  __atomic_store_n(&view, new_view, __ATOMIC_SEQ_CST);
+
+  // Wait for the readers of the old view. A reader that comes later reads the
+  // new view, so it cannot pick the old arrays or the retired nodes.
+  while (__atomic_load_n(&num_readers, __ATOMIC_SEQ_CST))
+    sched_yield();
+
+  chunk_store_view_free(old_view, new_view);
+  chunk_store_free_retired_nodes();
+  return;
+
+fail:
+  perror("chunk store allocation (publish)");
+  exit(EXIT_FAILURE);
+
+}
+
+node_t *chunk_store_worker_get_node(uint32_t id, size_t max_len) {
+
+  __atomic_add_fetch(&num_readers, 1, __ATOMIC_SEQ_CST);
+
+  node_t *            node = NULL;
+  chunk_store_view_t *cur_view = __atomic_load_n(&view, __ATOMIC_SEQ_CST);
+  if (cur_view && id < cur_view->num_types && cur_view->vectors[id])
+    node = node_share(chunk_vector_pick(cur_view->vectors[id], max_len));
+
+  __atomic_sub_fetch(&num_readers, 1, __ATOMIC_RELEASE);
+  return node;
+
+}
+
+void chunk_store_worker_add_node(node_t *node) {
+
+  pthread_mutex_lock(&queue_lock);
+  if (queue->size < CHUNK_STORE_WORKER_MAX_QUEUED) {
+
+    list_append(queue, node_share(node));
+    ++num_pending;
+    pthread_cond_signal(&queue_cond);
+
+  } else {
+
+    ++num_dropped;
+
+  }
+
+  pthread_mutex_unlock(&queue_lock);
+
+}
+
+void chunk_store_worker_get_stats(size_t *queued, size_t *dropped) {
+
+  pthread_mutex_lock(&queue_lock);
+  *queued = num_pending;
+  *dropped = num_dropped;
+  pthread_mutex_unlock(&queue_lock);
+
+}
+
+static void chunk_store_ingest(node_t *node) {
+
+  chunk_store_lock();
+
+  // The shared chunk store copies the subtrees into the file
+  if (shared_chunk_store_is_open())
+    shared_chunk_store_add_node(node);
+  else
+    chunk_store_take_node(chunk_store_copy_node(node));
+
+  chunk_store_unlock();
+
+  // The tree may have been freed by the mutator already
+  node_free(node);
+
+}
+
+static void *chunk_store_worker_main(void *arg) {
+
+  (void)arg;
+
+  // Evictions draw random numbers in this thread
+  random_set_state(&worker_random_state);
+
+  size_t num_ingested = 0;
+  pthread_mutex_lock(&queue_lock);
+  while (true) {
+
+    while (list_empty(queue) && !worker_stopping)
+      pthread_cond_wait(&queue_cond, &queue_lock);
+
+    if (worker_stopping) break;
+
+    node_t *node = list_pop_front(queue);
+    pthread_mutex_unlock(&queue_lock);
+
+    chunk_store_ingest(node);
+    ++num_ingested;
+
+    pthread_mutex_lock(&queue_lock);
+    if (!list_empty(queue) && num_ingested < CHUNK_STORE_WORKER_BATCH_SIZE)
+      continue;
+
+    // Do not block `chunk_store_add_tree` during the grace period
+    pthread_mutex_unlock(&queue_lock);
+    chunk_store_lock();
+    chunk_store_publish();
+    chunk_store_unlock();
+    pthread_mutex_lock(&queue_lock);
+
+    num_pending -= num_ingested;
+    num_ingested = 0;
+    pthread_cond_broadcast(&flushed_cond);
+
+  }
+
+  pthread_mutex_unlock(&queue_lock);
+  return NULL;
+
+}
+
+bool chunk_store_start_worker() {
+
+  if (worker_running) return true;
+
+  queue = list_create();
+  if (unlikely(!queue)) {
+
+    perror("chunk store worker allocation (list_create)");
+    return false;
+
+  }
+
+  // The worker has its own random numbers, derived from the calling thread
+  random_state_set_seed(&worker_random_state, random_next());
+  worker_stopping = false;
+  num_pending = 0;
+  num_dropped = 0;
+  worker_running = true;
+
+  // Chunks that have been stored so far are picked from the first view
+  chunk_store_lock();
+  chunk_store_publish();
+  chunk_store_unlock();
+
+  if (pthread_create(&worker, NULL, chunk_store_worker_main, NULL) != 0) {
+
+    perror("Cannot start the chunk store worker (pthread_create)");
+    worker_stopping = true;
+    chunk_store_stop_worker();
+    return false;
+
+  }
+
+  return true;
+
+}
+
+void chunk_store_flush() {
+
+  if (!worker_running) return;
+
+  pthread_mutex_lock(&queue_lock);
+  while (num_pending)
+    pthread_cond_wait(&flushed_cond, &queue_lock);
+  pthread_mutex_unlock(&queue_lock);
+
+}
+
+void chunk_store_stop_worker() {
+
+  if (!worker_running) return;
+
+  pthread_mutex_lock(&queue_lock);
+  bool started = !worker_stopping;
+  worker_stopping = true;
+  pthread_cond_signal(&queue_cond);
+  pthread_mutex_unlock(&queue_lock);
+  if (started) pthread_join(worker, NULL);
+
+  // Discard the queued trees
+  node_t *node;
+  while ((node = list_pop_front(queue)))
+    node_free(node);
+
+  list_free(queue);
+  queue = NULL;
+
+  pthread_mutex_lock(&queue_lock);
+  num_pending = 0;
+  pthread_cond_broadcast(&flushed_cond);
+  pthread_mutex_unlock(&queue_lock);
+
+  // Nobody reads the view anymore, and chunks are picked from the arrays of
+  // `chunk_store` again
+  chunk_store_lock();
+  chunk_store_view_free(view, NULL);
+  view = NULL;
+  chunk_store_free_retired_nodes();
+  free(retired_buf);
+  retired_buf = NULL;
+  retired_size = 0;
+  worker_running = false;
+  chunk_store_unlock();
+
+}
@@ -0,0 +1,166 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include "f1_c_fuzz.h"
+#include "gen_cache.h"
+#include "utils.h"
+
+#define GEN_CACHE_NUM_NODE_TYPES (sizeof(gen_funcs) / sizeof(gen_funcs[0]))
+
+typedef struct gen_cache_reservoir {
+
+  node_t **nodes;
+  int *    consumed;
+  size_t   size;
+  int      max_len;  // the `max_len` of all subtrees in `nodes`
+
+} gen_cache_reservoir_t;
+
+// One reservoir per node type, which is allocated on first use
+static gen_cache_reservoir_t *gen_cache = NULL;
+
+static size_t gen_cache_reservoir_size = 0;
+static double gen_cache_refresh_prob = 0;
+
+static gen_cache_stats_t gen_cache_stats;
+
+// Free the subtrees of a reservoir, which keeps its arrays
+static void gen_cache_reservoir_reset(gen_cache_reservoir_t *reservoir,
+                                      int                    max_len) {
+
+  for (size_t i = 0; i < reservoir->size; ++i)
+    node_free(reservoir->nodes[i]);
+
+  gen_cache_stats.num_nodes -= reservoir->size;
+  reservoir->size = 0;
+  reservoir->max_len = max_len;
+
+}
+
+void gen_cache_init(size_t reservoir_size, double refresh_prob) {
+
+  gen_cache_clear();
+
+  memset(&gen_cache_stats, 0, sizeof(gen_cache_stats));
+  if (!reservoir_size) return;
+
+  gen_cache = calloc(GEN_CACHE_NUM_NODE_TYPES, sizeof(gen_cache_reservoir_t));
+  if (unlikely(!gen_cache)) {
+
+    perror("generation cache allocation (gen_cache_init)");
+    return;
+
+  }
+
+  gen_cache_reservoir_size = reservoir_size;
+  gen_cache_refresh_prob = refresh_prob;
+
+}
+
+node_t *gen_cache_gen_node(int id, int max_len, int *consumed) {
+
+  if (!gen_cache) return gen_funcs[id](max_len, consumed, -1);
+
+  // Subtrees are generated with the exact `max_len` of the caller, so that
+  // cloning them does not change the distribution of generated subtrees
+  gen_cache_reservoir_t *reservoir = &gen_cache[id];
+  if (reservoir->max_len != max_len)
+    gen_cache_reservoir_reset(reservoir, max_len);
+
+  if (reservoir->size == gen_cache_reservoir_size &&
+      random_double() >= gen_cache_refresh_prob) {
+
+    ++gen_cache_stats.hits;
+    size_t i = random_below(reservoir->size);
+    *consumed = reservoir->consumed[i];
+    return node_clone(reservoir->nodes[i]);
+
+  }
+
+  if (unlikely(!reservoir->nodes)) {
+
+    reservoir->nodes = malloc(gen_cache_reservoir_size * sizeof(node_t *));
+    reservoir->consumed = malloc(gen_cache_reservoir_size * sizeof(int));
+    if (unlikely(!reservoir->nodes || !reservoir->consumed)) {
+
+      perror("generation cache reservoir allocation (gen_cache_gen_node)");
+      free(reservoir->nodes);
+      free(reservoir->consumed);
+      reservoir->nodes = NULL;
+      reservoir->consumed = NULL;
+      return gen_funcs[id](max_len, consumed, -1);
+
+    }
+
+  }
+
+  ++gen_cache_stats.misses;
+  int     node_consumed = 0;
+  node_t *node = gen_funcs[id](max_len, &node_consumed, -1);
+
+  // Append to the reservoir until it is full, and keep a copy of the new
+  // subtree for the caller
+  if (reservoir->size < gen_cache_reservoir_size) {
+
+    size_t i = reservoir->size++;
+    ++gen_cache_stats.num_nodes;
+    reservoir->nodes[i] = node;
+    reservoir->consumed[i] = node_consumed;
+    *consumed = node_consumed;
+    return node_clone(node);
+
+  }
+
+  // Once it is full, the new subtree replaces a random one, which is returned
+  // instead of a copy. Both have been generated with the same `max_len`.
+  size_t  i = random_below(reservoir->size);
+  node_t *evicted = reservoir->nodes[i];
+  *consumed = reservoir->consumed[i];
+  reservoir->nodes[i] = node;
+  reservoir->consumed[i] = node_consumed;
+
+  return evicted;
+
+}
+
+void gen_cache_get_stats(gen_cache_stats_t *stats) {
+
+  *stats = gen_cache_stats;
+
+}
+
+void gen_cache_clear() {
+
+  if (!gen_cache) return;
+
+  for (size_t i = 0; i < GEN_CACHE_NUM_NODE_TYPES; ++i) {
+
+    gen_cache_reservoir_t *reservoir = &gen_cache[i];
+    for (size_t j = 0; j < reservoir->size; ++j)
+      node_free(reservoir->nodes[j]);
+    free(reservoir->nodes);
+    free(reservoir->consumed);
+
+  }
+
+  free(gen_cache);
+  gen_cache = NULL;
+  gen_cache_reservoir_size = 0;
+  gen_cache_stats.num_nodes = 0;
+
+}
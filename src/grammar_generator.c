@@ -21,22 +21,228 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <limits.h>
+#include <pthread.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "f1_c_fuzz.h"
 #include "utils.h"
 
-int main(int argc, const char *argv[]) {
+typedef struct generator {
 
-  int         seed, max_num, max_len;
+  int         seed;
+  int         max_len;
+  const char *out_dir;
+  const char *tree_out_dir;  // NULL for the bytes-only mode
+  bool        boltzmann;  // `max_len` is the expected size
+
+  // Enumeration mode: the i-th test case is the tree of index
+  // `first + i * stride` among all trees of at most `max_len` characters
+  bool     enumerate;
+  uint64_t first;
+  uint64_t stride;
+
+  // The range of test cases (i.e., file names) of a worker
+  int start;
+  int end;
+
+  bool threaded;  // whether the range is generated by its own thread
+  bool failed;
+
+} generator_t;
+
+// Each test case has its own random stream, derived from the seed and its
+// index, so that the output does not depend on the number of workers
+static void set_test_case_seed(int seed, int index) {
+
+  random_set_seed(((uint64_t)(uint32_t)seed << 32) | (uint32_t)index);
+
+}
+
+static tree_t *generate_tree(generator_t *gen) {
+
+  if (gen->boltzmann) return gen_init_boltzmann__(gen->max_len);
+  return gen_init__(gen->max_len);
+
+}
+
+// Map an index among all trees of at most `max_len` characters (ordered by
+// size) to a tree
+static tree_t *unrank_tree(int max_len, uint64_t index) {
+
+  for (int size = 0; size <= max_len; ++size) {
+
+    uint64_t count = gen_count__(size);
+    if (index < count) return gen_unrank__(size, index);
+    index -= count;
+
+  }
+
+  return NULL;
+
+}
+
+static void *enumerate_test_cases(generator_t *gen) {
+
+  char fn[PATH_MAX];
+
+  for (int i = gen->start; i < gen->end; ++i) {
+
+    uint64_t index;
+    if (__builtin_mul_overflow((uint64_t)i, gen->stride, &index) ||
+        __builtin_add_overflow(index, gen->first, &index))
+      break;
+
+    // No more trees
+    tree_t *tree = unrank_tree(gen->max_len, index);
+    if (!tree) break;
+
+    // Name test cases by their indices, which are unique across machines
+    snprintf(fn, PATH_MAX, "%s/%llu", gen->out_dir, (unsigned long long)index);
+    if (!dump_tree_to_test_case(tree, fn)) gen->failed = true;
+    if (gen->tree_out_dir) {
+
+      snprintf(fn, PATH_MAX, "%s/%llu", gen->tree_out_dir,
+               (unsigned long long)index);
+      if (!write_tree_to_file(tree, fn)) gen->failed = true;
+
+    }
+
+    tree_free(tree);
+    if (gen->failed) break;
+
+  }
+
+  return NULL;
+
+}
+
+static void *generate_test_cases(void *arg) {
+
+  generator_t *gen = (generator_t *)arg;
+  char         fn[PATH_MAX];
+
+  if (gen->enumerate) return enumerate_test_cases(gen);
+
+  if (!gen->tree_out_dir && !gen->boltzmann) {
+
+    // Bytes-only mode
+    uint8_t *buf = NULL;
+    size_t   buf_size = 0;
+    for (int i = gen->start; i < gen->end; ++i) {
+
+      set_test_case_seed(gen->seed, i);
+      size_t len = gen_init_bytes__(gen->max_len, &buf, &buf_size);
+
+      snprintf(fn, PATH_MAX, "%s/%d", gen->out_dir, i);
+      FILE *fp = fopen(fn, "wb");
+      if (!fp) {
+
+        perror("Cannot open the test case file (grammar_generator)");
+        gen->failed = true;
+        break;
+
+      }
+
+      bool written = !len || fwrite(buf, len, 1, fp) == 1;
+      if (fclose(fp) != 0) written = false;
+      if (!written) {
+
+        perror("Cannot write the test case file (grammar_generator)");
+        gen->failed = true;
+        break;
+
+      }
+
+    }
+
+    free(buf);
+    return NULL;
+
+  }
+
+  tree_t *tree = NULL;
+  for (int i = gen->start; i < gen->end; ++i) {
+
+    set_test_case_seed(gen->seed, i);
+    tree = generate_tree(gen);
+
+    snprintf(fn, PATH_MAX, "%s/%d", gen->out_dir, i);
+    if (!dump_tree_to_test_case(tree, fn)) gen->failed = true;
+    if (gen->tree_out_dir) {
+
+      snprintf(fn, PATH_MAX, "%s/%d", gen->tree_out_dir, i);
+      if (!write_tree_to_file(tree, fn)) gen->failed = true;
+
+    }
+
+    tree_free(tree);
+    if (gen->failed) break;
+
+  }
+
+  return NULL;
+
+}
+
+static void usage(const char *program) {
+
+  printf(
+      "%s [-j <number of threads>] [-b | -e [-f <first index>] "
+      "[-s <stride>]] <max_num> <max_size> <output_dir> "
+      "[<tree_output_dir> [<random seed>]]\n"
+      "  Without <tree_output_dir> (or with \"-\"), only test cases are "
+      "generated, which skips building trees\n"
+      "  With -b, <max_size> is the expected size of test cases, which are "
+      "generated by Boltzmann sampling\n"
+      "  With -e, all trees of at most <max_size> characters are enumerated "
+      "by their indices, starting from <first index> (default: 0), with a "
+      "step of <stride> (default: 1)\n",
+      program);
+
+}
+
+int main(int argc, char *argv[]) {
+
+  int         seed, max_num, max_len, num_threads = 1;
+  bool        boltzmann = false, enumerate = false;
+  uint64_t    first = 0, stride = 1;
   const char *out_dir, *tree_out_dir;
+  const char *program = argv[0];
+  int         opt;
+
+  while ((opt = getopt(argc, argv, "j:bef:s:")) != -1) {
+
+    switch (opt) {
+
+      case 'j':
+        num_threads = atoi(optarg);
+        break;
+      case 'b':
+        boltzmann = true;
+        break;
+      case 'e':
+        enumerate = true;
+        break;
+      case 'f':
+        first = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        stride = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        usage(program);
+        return EXIT_FAILURE;
+
+    }
+
+  }
 
+  argc -= optind - 1;
+  argv += optind - 1;
   if (argc < 4) {
 
-    printf(
-        "%s <max_num> <max_size> <output_dir> <tree_output_dir> [<random "
-        "seed>]\n",
-        argv[0]);
+    usage(program);
     return 0;
 
   }
@@ -44,14 +250,51 @@ int main(int argc, const char *argv[]) {
   max_num = atoi(argv[1]);
   max_len = atoi(argv[2]);
   out_dir = argv[3];
-  tree_out_dir = argv[4];
+  tree_out_dir = NULL;
+  if (argc > 4 && strcmp(argv[4], "-") != 0) tree_out_dir = argv[4];
   if (argc > 5)
     seed = atoi(argv[5]);
   else
     seed = (int)time(NULL);
+  if (num_threads < 1) num_threads = 1;
+  if (max_num < 0) max_num = 0;
+
+  if (boltzmann && !GEN_HAS_BOLTZMANN) {
+
+    printf("Boltzmann sampling requires ENABLE_BOLTZMANN_GENERATOR=1\n");
+    return EXIT_FAILURE;
+
+  }
+
+  if (enumerate) {
+
+    if (max_len > GEN_ENUM_MAX_SIZE) {
 
-  printf("Using seed %d\n", seed);
-  random_set_seed((uint64_t)seed);
+      printf("Only trees of at most %d characters can be enumerated\n",
+             GEN_ENUM_MAX_SIZE);
+      max_len = GEN_ENUM_MAX_SIZE;
+
+    }
+
+    if (stride < 1) stride = 1;
+
+    uint64_t total = 0;
+    for (int size = 0; size <= max_len; ++size) {
+
+      if (__builtin_add_overflow(total, gen_count__(size), &total))
+        total = UINT64_MAX;
+
+    }
+
+    printf("Enumerating %s%llu trees of at most %d characters\n",
+           total == UINT64_MAX ? "at least " : "", (unsigned long long)total,
+           max_len);
+
+  } else {
+
+    printf("Using seed %d\n", seed);
+
+  }
 
   if (!create_directory(out_dir)) {
 
@@ -60,28 +303,73 @@ int main(int argc, const char *argv[]) {
 
   }
 
-  if (!create_directory(tree_out_dir)) {
+  if (tree_out_dir && !create_directory(tree_out_dir)) {
 
     fprintf(stderr, "Cannot create the tree output directory\n");
     return EXIT_FAILURE;
 
   }
 
-  char    fn[PATH_MAX];
-  tree_t *tree = NULL;
-  for (int i = 0; i < max_num; ++i) {
+  // Split test cases into contiguous ranges, one per worker
+  generator_t *gens = calloc(num_threads, sizeof(generator_t));
+  pthread_t *  threads = calloc(num_threads, sizeof(pthread_t));
+  if (!gens || !threads) {
 
-    tree = gen_init__(max_len);
+    perror("Cannot allocate workers (grammar_generator)");
+    return EXIT_FAILURE;
 
-    snprintf(fn, PATH_MAX, "%s/%d", out_dir, i);
-    dump_tree_to_test_case(tree, fn);
-    snprintf(fn, PATH_MAX, "%s/%d", tree_out_dir, i);
-    write_tree_to_file(tree, fn);
+  }
 
-    tree_free(tree);
+  int chunk = max_num / num_threads, remainder = max_num % num_threads;
+  int start = 0;
+  for (int i = 0; i < num_threads; ++i) {
+
+    gens[i].seed = seed;
+    gens[i].max_len = max_len;
+    gens[i].out_dir = out_dir;
+    gens[i].tree_out_dir = tree_out_dir;
+    gens[i].boltzmann = boltzmann;
+    gens[i].enumerate = enumerate;
+    gens[i].first = first;
+    gens[i].stride = stride;
+    gens[i].start = start;
+    gens[i].end = start + chunk + (i < remainder ? 1 : 0);
+    start = gens[i].end;
 
   }
 
-  return 0;
+  if (num_threads == 1) {
+
+    generate_test_cases(&gens[0]);
+
+  } else {
+
+    for (int i = 0; i < num_threads; ++i) {
+
+      gens[i].threaded = pthread_create(&threads[i], NULL, generate_test_cases,
+                                        &gens[i]) == 0;
+      if (!gens[i].threaded)
+        perror("Cannot start a worker (pthread_create)");
+
+    }
+
+    // Ranges without a thread are generated by this thread instead, which does
+    // not change the test cases
+    for (int i = 0; i < num_threads; ++i)
+      if (!gens[i].threaded) generate_test_cases(&gens[i]);
+
+    for (int i = 0; i < num_threads; ++i)
+      if (gens[i].threaded) pthread_join(threads[i], NULL);
+
+  }
+
+  bool failed = false;
+  for (int i = 0; i < num_threads; ++i)
+    failed |= gens[i].failed;
+
+  free(threads);
+  free(gens);
+
+  return failed ? EXIT_FAILURE : 0;
 
 }
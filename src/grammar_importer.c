@@ -0,0 +1,287 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+#include "map.h"
+#include "tree.h"
+#include "utils.h"
+
+typedef map_t(bool) seen_map_t;
+
+typedef struct importer {
+
+  const char *in_dir;
+  const char *out_dir;
+  const char *tree_out_dir;
+
+  // Names of all test cases in `in_dir`
+  char **names;
+  size_t num_names;
+
+  // The next test case to be parsed
+  size_t          next;
+  pthread_mutex_t lock;
+
+  // Hashes of serialized trees, for de-duplication (protected by `lock`)
+  seen_map_t seen_trees;
+
+  size_t num_parsed;
+  size_t num_duplicated;
+  size_t num_failed;
+  size_t num_recovered;  // trees that do not unparse to their test case
+
+} importer_t;
+
+static bool collect_test_cases(importer_t *importer) {
+
+  DIR *d = opendir(importer->in_dir);
+  if (!d) return false;
+
+  size_t         size = 0;
+  char           fn[PATH_MAX];
+  struct dirent *p;
+  while ((p = readdir(d))) {
+
+    // Skip ".", "..", and hidden files (e.g., ".state" of afl-fuzz)
+    if (p->d_name[0] == '.') continue;
+
+    snprintf(fn, PATH_MAX, "%s/%s", importer->in_dir, p->d_name);
+    struct stat info;
+    if (stat(fn, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+
+    if (importer->num_names == size) {
+
+      size = size ? size * 2 : 1024;
+      importer->names = realloc(importer->names, size * sizeof(char *));
+      if (!importer->names) {
+
+        perror("Cannot allocate the list of test cases");
+        closedir(d);
+        return false;
+
+      }
+
+    }
+
+    importer->names[importer->num_names++] = strdup(p->d_name);
+
+  }
+
+  closedir(d);
+  return true;
+
+}
+
+// Whether a structurally identical tree has been imported
+static bool check_seen_tree(importer_t *importer, tree_t *tree) {
+
+  char key[32 + 1];
+  tree_serialize(tree);
+  XXH128_hash_t hash = XXH3_128bits(tree->ser_buf, tree->ser_len);
+  snprintf(key, sizeof(key), "%016llX%016llX", (unsigned long long)hash.high64,
+           (unsigned long long)hash.low64);
+
+  bool seen = true;
+  pthread_mutex_lock(&importer->lock);
+  if (!map_get(&importer->seen_trees, key)) {
+
+    map_set(&importer->seen_trees, key, true);
+    seen = false;
+
+  }
+
+  pthread_mutex_unlock(&importer->lock);
+
+  return seen;
+
+}
+
+// Whether the last tree parsed by this thread differs from its test case
+static __thread bool last_tree_recovered;
+
+// Parse a test case, and check whether the parser recovered from errors by
+// dropping or inserting tokens
+static tree_t *import_parse(tree_t *base, const uint8_t *data_buf,
+                            size_t data_size) {
+
+  tree_t *tree = tree_from_buf_incremental(base, data_buf, data_size);
+  if (!tree) return NULL;
+
+  tree_to_buf(tree);
+  last_tree_recovered =
+      tree->data_len != data_size ||
+      (data_size && memcmp(tree->data_buf, data_buf, data_size) != 0);
+  return tree;
+
+}
+
+static void *import_worker(void *arg) {
+
+  importer_t *importer = (importer_t *)arg;
+  char        fn[PATH_MAX];
+
+  while (true) {
+
+    pthread_mutex_lock(&importer->lock);
+    size_t i = importer->next++;
+    pthread_mutex_unlock(&importer->lock);
+    if (i >= importer->num_names) break;
+
+    const char *name = importer->names[i];
+    snprintf(fn, PATH_MAX, "%s/%s", importer->in_dir, name);
+    tree_t *tree = load_tree_from_test_case_with(NULL, fn, import_parse);
+    if (!tree) {
+
+      fprintf(stderr, "Cannot parse %s\n", fn);
+      __atomic_add_fetch(&importer->num_failed, 1, __ATOMIC_RELAXED);
+      continue;
+
+    }
+
+    if (check_seen_tree(importer, tree)) {
+
+      __atomic_add_fetch(&importer->num_duplicated, 1, __ATOMIC_RELAXED);
+      tree_free(tree);
+      continue;
+
+    }
+
+    // The tree is still imported, but its test case is the unparsed tree
+    if (last_tree_recovered) {
+
+      fprintf(stderr, "%s is imported with parse errors\n", fn);
+      __atomic_add_fetch(&importer->num_recovered, 1, __ATOMIC_RELAXED);
+
+    }
+
+    // Use the same name for the test case and the tree, so that
+    // `afl_custom_queue_get` finds the tree via the "orig:" tag
+    snprintf(fn, PATH_MAX, "%s/%s", importer->out_dir, name);
+    dump_tree_to_test_case(tree, fn);
+    snprintf(fn, PATH_MAX, "%s/%s", importer->tree_out_dir, name);
+    write_tree_to_file(tree, fn);
+
+    __atomic_add_fetch(&importer->num_parsed, 1, __ATOMIC_RELAXED);
+    tree_free(tree);
+
+  }
+
+  return NULL;
+
+}
+
+int main(int argc, const char *argv[]) {
+
+  int        num_threads;
+  importer_t importer;
+
+  if (argc < 4) {
+
+    printf(
+        "%s <input_dir> <output_dir> <tree_output_dir> [<number of "
+        "threads>]\n",
+        argv[0]);
+    return 0;
+
+  }
+
+  memset(&importer, 0, sizeof(importer));
+  importer.in_dir = argv[1];
+  importer.out_dir = argv[2];
+  importer.tree_out_dir = argv[3];
+  if (argc > 4)
+    num_threads = atoi(argv[4]);
+  else
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_threads < 1) num_threads = 1;
+
+  if (!collect_test_cases(&importer)) {
+
+    fprintf(stderr, "Cannot read the input directory\n");
+    return EXIT_FAILURE;
+
+  }
+
+  if (!create_directory(importer.out_dir)) {
+
+    fprintf(stderr, "Cannot create the output directory\n");
+    return EXIT_FAILURE;
+
+  }
+
+  if (!create_directory(importer.tree_out_dir)) {
+
+    fprintf(stderr, "Cannot create the tree output directory\n");
+    return EXIT_FAILURE;
+
+  }
+
+  printf("Importing %zu test cases with %d threads\n", importer.num_names,
+         num_threads);
+
+  pthread_mutex_init(&importer.lock, NULL);
+  map_init(&importer.seen_trees);
+
+  pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+  int        num_started = 0;
+  for (int i = 0; threads && i < num_threads; ++i) {
+
+    if (pthread_create(&threads[num_started], NULL, import_worker,
+                       &importer) != 0) {
+
+      perror("Cannot start a worker (pthread_create)");
+      break;
+
+    }
+
+    ++num_started;
+
+  }
+
+  // Workers share the remaining test cases, so this thread imports them if no
+  // worker could be started
+  if (!num_started) import_worker(&importer);
+
+  for (int i = 0; i < num_started; ++i)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  printf("Imported: %zu (recovered from parse errors: %zu), duplicated: %zu, "
+         "failed: %zu\n",
+         importer.num_parsed, importer.num_recovered, importer.num_duplicated,
+         importer.num_failed);
+
+  map_deinit(&importer.seen_trees);
+  pthread_mutex_destroy(&importer.lock);
+  for (size_t i = 0; i < importer.num_names; ++i)
+    free(importer.names[i]);
+  free(importer.names);
+
+  return 0;
+
+}
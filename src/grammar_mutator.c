@@ -23,6 +23,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "helpers.h"
 #include "tree.h"
@@ -31,6 +34,9 @@
 #include "tree_mutation.h"
 #include "tree_trimming.h"
 #include "chunk_store.h"
+#include "gen_cache.h"
+#include "parse_cache.h"
+#include "parser_warm_up.h"
 #include "utils.h"
 
 // default number of mutations of three mutation strategies
@@ -41,19 +47,68 @@ size_t default_random_recursive_mutation_steps = 1000;
 // env: SPLICING_MUTATION_STEPS
 size_t default_splicing_mutation_steps = 1000;
 
+// maximal size (MB) of the in-memory parse cache
+// env: PARSE_CACHE_MAX_MB
+size_t default_parse_cache_max_mb = 64;
+// maximal size (MB) of the parse cache directory (0 means no limit)
+// env: PARSE_CACHE_DIR_MAX_MB
+size_t default_parse_cache_dir_max_mb = 1024;
+// skip parsing test cases with more invalid tokens (in percent)
+// env: MAX_INVALID_TOKEN_PERCENT
+size_t default_max_invalid_token_percent = 100;
+// number of generated samples per grammar rule to warm up the parser
+// env: PARSER_WARM_UP_NUM
+size_t default_parser_warm_up_num = 1;
+// number of cached subtrees per node type and length bucket (0 disables it)
+// env: GEN_CACHE_SIZE
+size_t default_gen_cache_size = 0;
+// probability (in percent) of generating a new subtree on a full reservoir
+// env: GEN_CACHE_REFRESH_PERCENT
+size_t default_gen_cache_refresh_percent = 10;
+// maximal memory footprint (MB) of the chunk store (0 means no limit)
+// env: CHUNK_STORE_MAX_MB
+size_t default_chunk_store_max_mb = 0;
+// interval (seconds) between snapshots of the chunk store (0 disables them)
+// env: CHUNK_STORE_SAVE_INTERVAL
+size_t default_chunk_store_save_interval = 600;
+// store new chunks in a background thread (0 stores them synchronously)
+// env: CHUNK_STORE_WORKER
+size_t default_chunk_store_worker = 0;
+
+// interval (seconds) between updates of `trees/chunk_store_stats`
+#define CHUNK_STORE_STATS_INTERVAL (60)
+
 static void load_env_configs() {
 
   char *ptr;
-  char *env_vars[4] = {
+  char *env_vars[13] = {
       "RANDOM_MUTATION_STEPS",
       "RANDOM_RECURSIVE_MUTATION_STEPS",
       "SPLICING_MUTATION_STEPS",
+      "PARSE_CACHE_MAX_MB",
+      "PARSE_CACHE_DIR_MAX_MB",
+      "MAX_INVALID_TOKEN_PERCENT",
+      "PARSER_WARM_UP_NUM",
+      "GEN_CACHE_SIZE",
+      "GEN_CACHE_REFRESH_PERCENT",
+      "CHUNK_STORE_MAX_MB",
+      "CHUNK_STORE_SAVE_INTERVAL",
+      "CHUNK_STORE_WORKER",
       NULL
   };
-  size_t *configs[4] = {
+  size_t *configs[13] = {
       &default_random_mutation_steps,
       &default_random_recursive_mutation_steps,
       &default_splicing_mutation_steps,
+      &default_parse_cache_max_mb,
+      &default_parse_cache_dir_max_mb,
+      &default_max_invalid_token_percent,
+      &default_parser_warm_up_num,
+      &default_gen_cache_size,
+      &default_gen_cache_refresh_percent,
+      &default_chunk_store_max_mb,
+      &default_chunk_store_save_interval,
+      &default_chunk_store_worker,
       NULL
   };
   int i = 0;
@@ -74,12 +129,6 @@ static void load_env_configs() {
 
 my_mutator_t *afl_custom_init(afl_t *afl, unsigned int seed) {
 
-  random_set_seed(seed);
-
-  load_env_configs();
-
-  chunk_store_init();
-
   my_mutator_t *data = (my_mutator_t *)calloc(1, sizeof(my_mutator_t));
   if (!data) {
 
@@ -90,6 +139,42 @@ my_mutator_t *afl_custom_init(afl_t *afl, unsigned int seed) {
 
   data->afl = afl;
 
+  // Each instance draws from its own RNG context, so that it can be
+  // reproduced regardless of other instances in the same process
+  random_state_set_seed(&data->random_state, seed);
+  random_set_state(&data->random_state);
+
+  load_env_configs();
+
+  chunk_store_init(default_chunk_store_max_mb << 20);
+
+  // env: CHUNK_STORE_SHARED_FILE, a file shared by all fuzzer instances on
+  // the same machine, whose size is CHUNK_STORE_MAX_MB
+  char *chunk_store_file = getenv("CHUNK_STORE_SHARED_FILE");
+  if (chunk_store_file && *chunk_store_file) {
+
+    chunk_store_share(chunk_store_file,
+                      (default_chunk_store_max_mb ? default_chunk_store_max_mb
+                                                  : 1024) << 20);
+
+  }
+
+  if (default_chunk_store_worker) chunk_store_start_worker();
+
+  gen_cache_init(default_gen_cache_size,
+                 default_gen_cache_refresh_percent / 100.0);
+
+  tree_set_max_invalid_token_ratio(default_max_invalid_token_percent / 100.0);
+
+  // env: PARSE_CACHE_DIR, a directory shared by all fuzzer instances
+  parse_cache_init(getenv("PARSE_CACHE_DIR"), default_parse_cache_max_mb << 20,
+                   default_parse_cache_dir_max_mb << 20);
+
+  // Warm up the DFA of the parser, so that parsing the queue does not start
+  // cold. env: PARSER_WARM_UP_DIR, e.g., the queue of a previous run
+  parser_warm_up_from_dir(getenv("PARSER_WARM_UP_DIR"));
+  parser_warm_up_generated(default_parser_warm_up_num, 100);
+
   return data;
 
 }
@@ -120,15 +205,62 @@ void afl_custom_deinit(my_mutator_t *data) {
   data->total_recursive_trimming_steps = 0;
 
   free(data->fuzz_buf);
+
+  // Store the queued trees before the last snapshot
+  chunk_store_flush();
+  if (default_chunk_store_save_interval && data->chunk_store_fn[0])
+    chunk_store_save(data->chunk_store_fn);
+  if (data->chunk_store_stats_fn[0])
+    chunk_store_write_stats(data->chunk_store_stats_fn);
+
+  // Do not leave a dangling RNG context selected
+  random_state_t *cur_state = random_set_state(NULL);
+  if (cur_state != &data->random_state) random_set_state(cur_state);
+
   free(data);
 
   chunk_store_clear();
+  gen_cache_clear();
+  parse_cache_clear();
+
+}
+
+// Save a snapshot of the chunk store, if the last one is too old
+static void maybe_save_chunk_store(my_mutator_t *data) {
+
+  if (!default_chunk_store_save_interval || !data->chunk_store_fn[0]) return;
+
+  time_t now = time(NULL);
+  if ((size_t)(now - data->chunk_store_saved_at) <
+      default_chunk_store_save_interval)
+    return;
+
+  chunk_store_save(data->chunk_store_fn);
+  data->chunk_store_saved_at = now;
+
+}
+
+// Update the statistics file of the chunk store, like `fuzzer_stats` of
+// afl-fuzz
+static void maybe_write_chunk_store_stats(my_mutator_t *data) {
+
+  if (!data->chunk_store_stats_fn[0]) return;
+
+  time_t now = time(NULL);
+  if (now - data->chunk_store_stats_written_at < CHUNK_STORE_STATS_INTERVAL)
+    return;
+
+  chunk_store_write_stats(data->chunk_store_stats_fn);
+  data->chunk_store_stats_written_at = now;
 
 }
 
 // For each interesting test case in the queue
 uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
+  maybe_save_chunk_store(data);
+  maybe_write_chunk_store_stats(data);
+
   const char *fn = (const char *)filename;
   data->filename_cur = filename;
   if (data->tree_cur) {
@@ -215,6 +347,22 @@ uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
     }
 
+    // Restore the chunk store from the snapshot of the previous run, so that
+    // splicing does not wait for all trees to be added again
+    if (unlikely(default_chunk_store_save_interval &&
+                 !data->chunk_store_fn[0])) {
+
+      snprintf(data->chunk_store_fn, PATH_MAX - 1, "%s/.chunk_store",
+               tree_out_dir);
+      chunk_store_load(data->chunk_store_fn);
+      data->chunk_store_saved_at = time(NULL);
+
+    }
+
+    if (unlikely(!data->chunk_store_stats_fn[0]))
+      snprintf(data->chunk_store_stats_fn, PATH_MAX - 1,
+               "%s/chunk_store_stats", tree_out_dir);
+
     free(tree_out_dir);
 
   }
@@ -234,8 +382,8 @@ uint8_t afl_custom_queue_get(my_mutator_t *data, const uint8_t *filename) {
 
   }
 
-  // try to parse the test case
-  data->tree_cur = load_tree_from_test_case(fn);
+  // try to parse the test case, unless its content has been seen before
+  data->tree_cur = parse_cache_load_tree_from_test_case(fn);
   if (data->tree_cur) {
 
     // Now that we've parsed it, cache the info from this test case in
@@ -286,6 +434,8 @@ size_t afl_custom_trim(my_mutator_t *data, uint8_t **out_buf) {
   size_t  trimmed_size = 0;
   tree_t *tree_cur = data->tree_cur;
 
+  random_set_state(&data->random_state);
+
   if (data->cur_trimming_stage == 0) {
 
     // subtree trimming
@@ -518,6 +668,8 @@ size_t afl_custom_fuzz(my_mutator_t *data, __attribute__((unused)) uint8_t *buf,
   tree_t *tree = NULL;
   size_t  mutated_size = 0;
 
+  random_set_state(&data->random_state);
+
   if (data->mutated_tree) {
 
     /* `data->mutated_tree` is not NULL, meaning that this is not an interesting
@@ -577,8 +729,9 @@ size_t afl_custom_fuzz(my_mutator_t *data, __attribute__((unused)) uint8_t *buf,
 
       }
     case 3:
-      // splicing mutation
-      tree = splicing_mutation(tree);
+      // splicing mutation, which never exceeds `max_size`, as a truncated test
+      // case is likely invalid
+      tree = splicing_mutation_within(tree, max_size);
       break;
     default:
       perror("mutation error, invalid choice (afl_custom_fuzz)");
@@ -692,13 +845,35 @@ size_t afl_custom_fuzz(my_mutator_t *data, __attribute__((unused)) uint8_t *buf,
 
 }
 
+// Check whether a test case file contains exactly the unparsed `tree`
+static bool test_case_equals_tree(const char *filename, tree_t *tree) {
+
+  int fd = open(filename, O_RDONLY);
+  if (unlikely(fd < 0)) return false;
+
+  struct stat info;
+  bool        ret = false;
+  if (fstat(fd, &info) == 0 && (size_t)info.st_size == tree->data_len) {
+
+    uint8_t *buf = malloc(tree->data_len + 1);
+    ret = buf && read(fd, buf, tree->data_len) == (ssize_t)tree->data_len &&
+          memcmp(buf, tree->data_buf, tree->data_len) == 0;
+    free(buf);
+
+  }
+
+  close(fd);
+  return ret;
+
+}
+
 // Save interesting mutated test cases
 void afl_custom_queue_new_entry(my_mutator_t * data,
                                 const uint8_t *filename_new_queue,
                                 const uint8_t *filename_orig_queue) {
 
   // If this is an initial case or sync, then we will get called with a null "filename_orig_queue".
-  if (unlikely(!filename_orig_queue || !data->mutated_tree)) {
+  if (unlikely(!filename_orig_queue)) {
 
     // In that situation, we can skip it here and let afl_custom_queue_get() import the data later,
     // or we can prefetch it here to ensure that it gets into our splicing data set (chunk_store) asap.
@@ -725,9 +900,49 @@ void afl_custom_queue_new_entry(my_mutator_t * data,
   // Replace "queue" with "trees"
   memcpy(found, "/trees", 6);
 
+  // `mutated_tree` is kept until the next `afl_custom_fuzz`, so it is a stale
+  // mutant if the new entry comes from another stage (e.g., havoc)
+  if (data->mutated_tree && !test_case_equals_tree(fn, data->mutated_tree)) {
+
+    tree_free(data->mutated_tree);
+    data->mutated_tree = NULL;
+
+  }
+
+  if (!data->mutated_tree) {
+
+    // The new entry comes from a byte-level stage of afl-fuzz (e.g., havoc),
+    // so most of it still matches the tree of its parent. If the parent is the
+    // current test case, only re-parse the modified region of its tree.
+    if (!data->tree_cur || !data->filename_cur ||
+        strcmp((const char *)filename_orig_queue,
+               (const char *)data->filename_cur) != 0) {
+
+      afl_custom_queue_get(data, filename_new_queue);
+      return;
+
+    }
+
+    tree_t *tree = load_tree_from_test_case_incremental(data->tree_cur, fn);
+    if (unlikely(!tree)) return;  // parsing error, skip this test case
+
+    tree_get_size(tree);
+    write_tree_to_file(tree, data->new_tree_fn);
+    tree_to_buf(tree);
+    parse_cache_add(tree->data_buf, tree->data_len, tree);
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+    return;
+
+  }
+
   // Write the mutated tree to the file
   write_tree_to_file(data->mutated_tree, data->new_tree_fn);
 
+  // Other instances will see the same test case after syncing
+  parse_cache_add(data->mutated_tree->data_buf, data->mutated_tree->data_len,
+                  data->mutated_tree);
+
   // Store all subtrees in the newly added tree
   chunk_store_add_tree(data->mutated_tree);
 
@@ -0,0 +1,170 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash_table.h"
+#include "helpers.h"
+
+#define HASH_TABLE_MIN_CAPACITY (16)
+
+static inline bool hash_key_equal(hash_key_t a, hash_key_t b) {
+
+  return a.low64 == b.low64 && a.high64 == b.high64;
+
+}
+
+// Keep the load factor below 3/4
+static inline bool hash_table_is_full(size_t size, size_t capacity) {
+
+  return size * 4 >= capacity * 3;
+
+}
+
+// Find the slot of a key, or the empty slot where the key would be inserted
+static hash_table_entry_t *hash_table_find(hash_table_entry_t *entries,
+                                           size_t capacity, hash_key_t key) {
+
+  size_t mask = capacity - 1;
+  size_t i = key.low64 & mask;
+  while (entries[i].value && !hash_key_equal(entries[i].key, key)) {
+
+    i = (i + 1) & mask;
+
+  }
+
+  return &entries[i];
+
+}
+
+static bool hash_table_resize(hash_table_t *table, size_t capacity) {
+
+  hash_table_entry_t *entries = calloc(capacity, sizeof(hash_table_entry_t));
+  if (unlikely(!entries)) {
+
+    perror("hash table allocation (calloc)");
+    return false;
+
+  }
+
+  for (size_t i = 0; i < table->capacity; ++i) {
+
+    hash_table_entry_t *entry = &table->entries[i];
+    if (entry->value) *hash_table_find(entries, capacity, entry->key) = *entry;
+
+  }
+
+  free(table->entries);
+  table->entries = entries;
+  table->capacity = capacity;
+  return true;
+
+}
+
+bool hash_table_init(hash_table_t *table, size_t capacity) {
+
+  table->entries = NULL;
+  table->capacity = 0;
+  table->size = 0;
+
+  capacity = next_pow2(capacity + capacity / 3 + 1);
+  if (capacity < HASH_TABLE_MIN_CAPACITY) capacity = HASH_TABLE_MIN_CAPACITY;
+  return hash_table_resize(table, capacity);
+
+}
+
+void hash_table_deinit(hash_table_t *table) {
+
+  free(table->entries);
+  table->entries = NULL;
+  table->capacity = 0;
+  table->size = 0;
+
+}
+
+void **hash_table_get(hash_table_t *table, hash_key_t key) {
+
+  if (unlikely(!table->entries)) return NULL;
+
+  hash_table_entry_t *entry =
+      hash_table_find(table->entries, table->capacity, key);
+  return entry->value ? &entry->value : NULL;
+
+}
+
+bool hash_table_set(hash_table_t *table, hash_key_t key, void *value) {
+
+  if (unlikely(!value)) return false;
+
+  if (unlikely(!table->entries ||
+               hash_table_is_full(table->size + 1, table->capacity))) {
+
+    size_t capacity =
+        table->capacity ? table->capacity * 2 : HASH_TABLE_MIN_CAPACITY;
+    if (!hash_table_resize(table, capacity)) return false;
+
+  }
+
+  hash_table_entry_t *entry =
+      hash_table_find(table->entries, table->capacity, key);
+  if (!entry->value) {
+
+    entry->key = key;
+    ++table->size;
+
+  }
+
+  entry->value = value;
+  return true;
+
+}
+
+bool hash_table_remove(hash_table_t *table, hash_key_t key) {
+
+  if (unlikely(!table->entries)) return false;
+
+  size_t              mask = table->capacity - 1;
+  hash_table_entry_t *entry =
+      hash_table_find(table->entries, table->capacity, key);
+  if (!entry->value) return false;
+
+  // Backward-shift deletion: move the following entries of the same probe
+  // sequence into the hole, so that lookups never need tombstones
+  size_t hole = entry - table->entries;
+  size_t i = hole;
+  while (true) {
+
+    i = (i + 1) & mask;
+    hash_table_entry_t *next = &table->entries[i];
+    if (!next->value) break;
+
+    // Keep the entry if its home slot is cyclically in (hole, i]
+    size_t home = next->key.low64 & mask;
+    if (((i - home) & mask) < ((i - hole) & mask)) continue;
+
+    table->entries[hole] = *next;
+    hole = i;
+
+  }
+
+  table->entries[hole].value = NULL;
+  --table->size;
+  return true;
+
+}
@@ -0,0 +1,353 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define XXH_INLINE_ALL
+#include "xxhash.h"
+#include "f1_c_fuzz.h"
+#include "map.h"
+#include "list.h"
+#include "parse_cache.h"
+#include "utils.h"
+
+#define PARSE_CACHE_KEY_LEN (32)
+
+typedef struct parse_cache_entry {
+
+  char     key[PARSE_CACHE_KEY_LEN + 1];
+  uint8_t *ser_buf;
+  size_t   ser_len;
+
+} parse_cache_entry_t;
+
+// Map of content hashes to cached entries
+typedef map_t(parse_cache_entry_t *) entry_map_t;
+static entry_map_t parse_cache;
+
+// All cached entries, in the order of insertion (oldest first)
+static list_t *parse_cache_entries = NULL;
+
+static size_t parse_cache_size = 0;
+static size_t parse_cache_max_size = 0;
+static char * parse_cache_dir = NULL;
+static size_t parse_cache_dir_max_size = 0;
+static size_t parse_cache_dir_written = 0;  // bytes written since the last trim
+
+typedef struct parse_cache_file {
+
+  char   key[PARSE_CACHE_KEY_LEN + 1];
+  time_t mtime;
+  size_t size;
+
+} parse_cache_file_t;
+
+// Hex representation of the 128-bit XXH3 hash of the test case
+static void parse_cache_key(const uint8_t *data_buf, size_t data_size,
+                            char dest[PARSE_CACHE_KEY_LEN + 1]) {
+
+  XXH128_hash_t hash = XXH3_128bits(data_buf, data_size);
+  snprintf(dest, PARSE_CACHE_KEY_LEN + 1, "%016llX%016llX",
+           (unsigned long long)hash.high64, (unsigned long long)hash.low64);
+
+}
+
+static void parse_cache_entry_free(parse_cache_entry_t *entry) {
+
+  if (!entry) return;
+
+  free(entry->ser_buf);
+  free(entry);
+
+}
+
+// Keep a copy of the serialized tree in memory, and evict the oldest entries
+// if the cache is full
+static void parse_cache_insert(const char *key, const uint8_t *ser_buf,
+                               size_t ser_len) {
+
+  size_t entry_size = sizeof(parse_cache_entry_t) + ser_len;
+  if (entry_size > parse_cache_max_size) return;
+  if (map_get(&parse_cache, key)) return;
+
+  while (parse_cache_size + entry_size > parse_cache_max_size) {
+
+    parse_cache_entry_t *oldest = list_pop_front(parse_cache_entries);
+    if (unlikely(!oldest)) break;
+
+    map_remove(&parse_cache, oldest->key);
+    parse_cache_size -= sizeof(parse_cache_entry_t) + oldest->ser_len;
+    parse_cache_entry_free(oldest);
+
+  }
+
+  parse_cache_entry_t *entry = calloc(1, sizeof(parse_cache_entry_t));
+  if (unlikely(!entry)) {
+
+    perror("parse cache entry allocation (calloc)");
+    return;
+
+  }
+
+  entry->ser_buf = malloc(ser_len);
+  if (unlikely(!entry->ser_buf)) {
+
+    perror("parse cache entry allocation (malloc)");
+    free(entry);
+    return;
+
+  }
+
+  memcpy(entry->key, key, PARSE_CACHE_KEY_LEN + 1);
+  memcpy(entry->ser_buf, ser_buf, ser_len);
+  entry->ser_len = ser_len;
+
+  map_set(&parse_cache, entry->key, entry);
+  list_append(parse_cache_entries, entry);
+  parse_cache_size += entry_size;
+
+}
+
+static int parse_cache_file_cmp(const void *a, const void *b) {
+
+  time_t mtime_a = ((const parse_cache_file_t *)a)->mtime;
+  time_t mtime_b = ((const parse_cache_file_t *)b)->mtime;
+  return (mtime_a > mtime_b) - (mtime_a < mtime_b);
+
+}
+
+// Remove the oldest trees from the cache directory, until it takes 3/4 of its
+// maximal size. The directory is shared, so its size is checked on disk.
+static void parse_cache_trim_dir() {
+
+  parse_cache_dir_written = 0;
+  if (!parse_cache_dir || !parse_cache_dir_max_size) return;
+
+  DIR *dir = opendir(parse_cache_dir);
+  if (unlikely(!dir)) {
+
+    perror("Cannot open the parse cache directory (parse_cache_trim_dir)");
+    return;
+
+  }
+
+  parse_cache_file_t *files = NULL;
+  size_t              num_files = 0, capacity = 0, total_size = 0;
+  struct dirent *     ent;
+  struct stat         info;
+  char                fn[PATH_MAX];
+  while ((ent = readdir(dir)) != NULL) {
+
+    // Skip temporary files, which are being written by other processes
+    if (strlen(ent->d_name) != PARSE_CACHE_KEY_LEN) continue;
+
+    snprintf(fn, PATH_MAX, "%s/%s", parse_cache_dir, ent->d_name);
+    if (stat(fn, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+
+    if (num_files == capacity) {
+
+      capacity = capacity ? capacity * 2 : 256;
+      parse_cache_file_t *new_files =
+          realloc(files, capacity * sizeof(parse_cache_file_t));
+      if (unlikely(!new_files)) {
+
+        perror("parse cache file list allocation (realloc)");
+        break;
+
+      }
+
+      files = new_files;
+
+    }
+
+    memcpy(files[num_files].key, ent->d_name, PARSE_CACHE_KEY_LEN + 1);
+    files[num_files].mtime = info.st_mtime;
+    files[num_files].size = info.st_size;
+    total_size += info.st_size;
+    ++num_files;
+
+  }
+
+  closedir(dir);
+
+  if (total_size > parse_cache_dir_max_size) {
+
+    qsort(files, num_files, sizeof(parse_cache_file_t), parse_cache_file_cmp);
+    for (size_t i = 0;
+         i < num_files && total_size > parse_cache_dir_max_size / 4 * 3; ++i) {
+
+      // Another process may have removed it already
+      snprintf(fn, PATH_MAX, "%s/%s", parse_cache_dir, files[i].key);
+      unlink(fn);
+      total_size -= files[i].size;
+
+    }
+
+  }
+
+  free(files);
+
+}
+
+void parse_cache_init(const char *cache_dir, size_t max_size,
+                      size_t dir_max_size) {
+
+  map_init(&parse_cache);
+  parse_cache_entries = list_create();
+  parse_cache_size = 0;
+  parse_cache_max_size = max_size;
+
+  parse_cache_dir_max_size = dir_max_size;
+  parse_cache_dir_written = 0;
+
+  // Trees are kept in a subdirectory per grammar, so that a directory can be
+  // reused by fuzzers of other grammars
+  parse_cache_dir = NULL;
+  if (cache_dir && *cache_dir) {
+
+    char dir[PATH_MAX];
+    snprintf(dir, PATH_MAX, "%s/%016llX", cache_dir,
+             (unsigned long long)GEN_GRAMMAR_HASH);
+    if (create_directory(cache_dir) && create_directory(dir)) {
+
+      parse_cache_dir = strdup(dir);
+      parse_cache_trim_dir();
+
+    } else {
+
+      perror("Cannot create the parse cache directory (parse_cache_init)");
+
+    }
+
+  }
+
+}
+
+tree_t *parse_cache_get(const uint8_t *data_buf, size_t data_size) {
+
+  if (unlikely(!parse_cache_entries)) return NULL;  // not initialized
+
+  char key[PARSE_CACHE_KEY_LEN + 1];
+  parse_cache_key(data_buf, data_size, key);
+
+  parse_cache_entry_t **p_entry = map_get(&parse_cache, key);
+  if (p_entry) {
+
+    parse_cache_entry_t *entry = *p_entry;
+    return tree_deserialize(entry->ser_buf, entry->ser_len);
+
+  }
+
+  if (!parse_cache_dir) return NULL;
+
+  // The tree may have been saved by another process
+  char fn[PATH_MAX];
+  snprintf(fn, PATH_MAX, "%s/%s", parse_cache_dir, key);
+  tree_t *tree = read_tree_from_file(fn);
+  if (!tree) return NULL;
+
+  // Only trust the tree if it is unparsed to the same test case, e.g., not if
+  // the file is corrupt
+  tree_to_buf(tree);
+  if (tree->data_len != data_size ||
+      (data_size && memcmp(tree->data_buf, data_buf, data_size) != 0)) {
+
+    tree_free(tree);
+    unlink(fn);
+    return NULL;
+
+  }
+
+  tree_serialize(tree);
+  parse_cache_insert(key, tree->ser_buf, tree->ser_len);
+  return tree;
+
+}
+
+void parse_cache_add(const uint8_t *data_buf, size_t data_size, tree_t *tree) {
+
+  if (unlikely(!parse_cache_entries)) return;  // not initialized
+  if (unlikely(!tree || !tree->root)) return;
+
+  char key[PARSE_CACHE_KEY_LEN + 1];
+  parse_cache_key(data_buf, data_size, key);
+  if (map_get(&parse_cache, key)) return;
+
+  if (parse_cache_dir) {
+
+    char fn[PATH_MAX];
+    snprintf(fn, PATH_MAX, "%s/%s", parse_cache_dir, key);
+    if (access(fn, F_OK) != 0) {
+
+      // Write to a temporary file at first, so that other processes never
+      // read a partially written tree
+      char tmp_fn[PATH_MAX];
+      snprintf(tmp_fn, PATH_MAX, "%s/.%s.%d", parse_cache_dir, key,
+               (int)getpid());
+      if (!write_tree_to_file(tree, tmp_fn) || rename(tmp_fn, fn) != 0)
+        unlink(tmp_fn);
+
+      parse_cache_dir_written += tree->ser_len;
+      if (parse_cache_dir_max_size &&
+          parse_cache_dir_written >= parse_cache_dir_max_size / 8)
+        parse_cache_trim_dir();
+
+    }
+
+  }
+
+  tree_serialize(tree);
+  parse_cache_insert(key, tree->ser_buf, tree->ser_len);
+
+}
+
+// Look up the tree of the file content, before parsing it
+static tree_t *parse_cache_parse(tree_t *base, const uint8_t *data_buf,
+                                 size_t data_size) {
+
+  tree_t *tree = parse_cache_get(data_buf, data_size);
+  if (tree) return tree;
+
+  tree = tree_from_buf_incremental(base, data_buf, data_size);
+  if (tree) parse_cache_add(data_buf, data_size, tree);
+  return tree;
+
+}
+
+tree_t *parse_cache_load_tree_from_test_case(const char *filename) {
+
+  return load_tree_from_test_case_with(NULL, filename, parse_cache_parse);
+
+}
+
+void parse_cache_clear() {
+
+  if (!parse_cache_entries) return;
+
+  map_deinit(&parse_cache);
+  list_free_with_data_free_func(parse_cache_entries,
+                                (data_free_t)parse_cache_entry_free);
+  parse_cache_entries = NULL;
+  parse_cache_size = 0;
+
+  free(parse_cache_dir);
+  parse_cache_dir = NULL;
+
+}
@@ -0,0 +1,110 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "f1_c_fuzz.h"
+#include "parser_warm_up.h"
+#include "tree.h"
+#include "utils.h"
+
+#define NUM_NODE_TYPES (sizeof(gen_funcs) / sizeof(gen_funcs[0]))
+
+size_t parser_warm_up_generated(size_t num, int max_len) {
+
+  size_t num_parsed = 0;
+
+  // Samples are generated with their own random numbers, so that warming up
+  // does not change the random stream of the calling fuzzer instance
+  random_state_t  warm_up_random_state;
+  random_state_t *prev_random_state = random_set_state(&warm_up_random_state);
+  random_state_set_seed(&warm_up_random_state, 0);
+
+  // Only used as the output buffer of `tree_to_buf`
+  tree_t *tree = tree_create();
+
+  for (size_t i = 0; i < num; ++i) {
+
+    // "0" means the terminal node
+    for (uint32_t id = 1; id < NUM_NODE_TYPES; ++id) {
+
+      for (uint32_t rule_id = 0; rule_id < node_num_rules[id]; ++rule_id) {
+
+        int consumed = 0;
+        tree->root = gen_funcs[id](max_len, &consumed, rule_id);
+        tree_to_buf(tree);
+
+        node_t *node = node_from_buf(id, tree->data_buf, tree->data_len);
+        if (node) ++num_parsed;
+
+        node_free(node);
+        node_free(tree->root);
+        tree->root = NULL;
+
+      }
+
+    }
+
+  }
+
+  tree_free(tree);
+  random_set_state(prev_random_state);
+
+  return num_parsed;
+
+}
+
+size_t parser_warm_up_from_dir(const char *dir) {
+
+  if (!dir || !*dir) return 0;
+
+  DIR *d = opendir(dir);
+  if (!d) {
+
+    perror("Cannot open the warm-up directory (parser_warm_up_from_dir)");
+    return 0;
+
+  }
+
+  size_t         num_parsed = 0;
+  char           fn[PATH_MAX];
+  struct dirent *p;
+  while ((p = readdir(d))) {
+
+    // Skip ".", "..", and hidden files
+    if (p->d_name[0] == '.') continue;
+
+    snprintf(fn, PATH_MAX, "%s/%s", dir, p->d_name);
+
+    struct stat info;
+    if (stat(fn, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+
+    tree_t *tree = load_tree_from_test_case(fn);
+    if (tree) ++num_parsed;
+
+    tree_free(tree);
+
+  }
+
+  closedir(d);
+
+  return num_parsed;
+
+}
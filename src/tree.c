@@ -110,6 +110,20 @@ void node_free(node_t *node) {
 
   if (!node) return;
 
+  // Another owner still uses the node. The count is updated atomically, as
+  // the owners may be in different threads (e.g., the chunk store worker).
+  uint32_t share_count = __atomic_load_n(&node->share_count, __ATOMIC_ACQUIRE);
+  while (share_count) {
+
+    if (__atomic_compare_exchange_n(&node->share_count, &share_count,
+                                    share_count - 1, true, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+      return;
+
+  }
+
+  if (node->ref_count) return;  // owned by the chunk store
+
   // id
   node->id = 0;
 
@@ -157,6 +171,13 @@ void node_free(node_t *node) {
 
 }
 
+node_t *node_share(node_t *node) {
+
+  if (node) __atomic_add_fetch(&node->share_count, 1, __ATOMIC_RELAXED);
+  return node;
+
+}
+
 void node_free_only_self(node_t *node) {
 
   // Pretend we don't have any subnodes so that node_free() won't
@@ -329,6 +350,19 @@ bool node_replace_subnode(node_t *root, node_t *subnode, node_t *new_subnode) {
 
 }
 
+size_t node_get_data_len(node_t *node) {
+
+  if (!node) return 0;
+  if (node->subnode_count == 0) return node->val_len;
+
+  size_t len = 0;
+  for (uint32_t i = 0; i < node->subnode_count; ++i)
+    len += node_get_data_len(node->subnodes[i]);
+
+  return len;
+
+}
+
 node_t *node_pick_non_term_subnode(node_t *node) {
 
   if (!node) return NULL;
@@ -637,6 +671,44 @@ node_t *_node_deserialize(const uint8_t *data_buf, size_t data_size,
 
 }
 
+// Find the deepest non-terminal node whose unparsed output covers the byte
+// range [lo, hi). `offset` tracks the position of `node` in the output of
+// `_node_to_buf`, and the span of the found node is stored in `found_start`
+// and `found_len`.
+static void _node_find_enclosing(node_t *node, size_t lo, size_t hi,
+                                 size_t *offset, node_t **found,
+                                 size_t *found_start, size_t *found_len) {
+
+  if (!node) return;
+
+  size_t start = *offset;
+  if (node->subnode_count == 0) {
+
+    *offset += node->val_len;
+
+  } else {
+
+    for (uint32_t i = 0; i < node->subnode_count; ++i) {
+
+      _node_find_enclosing(node->subnodes[i], lo, hi, offset, found,
+                           found_start, found_len);
+
+      // Subnodes are visited first, so the first match is the deepest one
+      if (*found) return;
+
+    }
+
+  }
+
+  if (node->id == 0) return;  // "0" means the terminal node
+  if (start > lo || *offset < hi) return;
+
+  *found = node;
+  *found_start = start;
+  *found_len = *offset - start;
+
+}
+
 inline tree_t *tree_create() {
 
   return calloc(1, sizeof(tree_t));
@@ -732,6 +804,65 @@ tree_t *tree_deserialize(const uint8_t *data_buf, size_t data_size) {
 
 }
 
+tree_t *tree_from_buf_incremental(tree_t *base, const uint8_t *data_buf,
+                                  size_t data_size) {
+
+  if (!base || !base->root) return tree_from_buf(data_buf, data_size);
+
+  tree_to_buf(base);
+  const uint8_t *old_buf = base->data_buf;
+  size_t         old_len = base->data_len;
+
+  // Locate the modified bytes by skipping the common prefix and suffix
+  size_t min_len = old_len < data_size ? old_len : data_size;
+  size_t prefix = 0;
+  while (prefix < min_len && old_buf[prefix] == data_buf[prefix])
+    ++prefix;
+
+  size_t suffix = 0;
+  while (suffix < min_len - prefix &&
+         old_buf[old_len - 1 - suffix] == data_buf[data_size - 1 - suffix])
+    ++suffix;
+
+  if (prefix == old_len && old_len == data_size) return tree_clone(base);
+
+  node_t *node = NULL;
+  size_t  start = 0, len = 0, offset = 0;
+  _node_find_enclosing(base->root, prefix, old_len - suffix, &offset, &node,
+                       &start, &len);
+  if (!node) return tree_from_buf(data_buf, data_size);
+
+  // Re-parse the modified region of the subtree as the same non-terminal.
+  // Note that, `len + data_size >= old_len`, as the subtree covers all
+  // modified bytes.
+  node_t *new_node =
+      node_from_buf(node->id, data_buf + start, len + data_size - old_len);
+  if (!new_node) return tree_from_buf(data_buf, data_size);
+
+  // `base` is not modified, as it may be shared (e.g., by the chunk store)
+  tree_t *tree = tree_replace_node(base, node, new_node);
+  if (unlikely(!tree)) {
+
+    node_free(new_node);
+    return tree_from_buf(data_buf, data_size);
+
+  }
+
+  // The lexer may have dropped unrecognized characters, so double-check the
+  // result before trusting it
+  tree_to_buf(tree);
+  if (unlikely(tree->data_len != data_size ||
+               memcmp(tree->data_buf, data_buf, data_size) != 0)) {
+
+    tree_free(tree);
+    return tree_from_buf(data_buf, data_size);
+
+  }
+
+  return tree;
+
+}
+
 tree_t *tree_clone(tree_t *tree) {
 
   tree_t *new_tree = tree_create();
@@ -746,6 +877,59 @@ tree_t *tree_clone(tree_t *tree) {
 
 }
 
+// Copy the nodes on the path from `cur` to `node`, where `node` is replaced by
+// `new_node`. Subtrees beside the path are shared.
+static node_t *node_copy_path(node_t *cur, node_t *node, node_t *new_node) {
+
+  if (cur == node) return new_node;
+
+  node_t *subnode = NULL;
+  for (uint32_t i = 0; i < cur->subnode_count; ++i) {
+
+    // `subnode` may be NULL due to parsing errors
+    if (unlikely(!cur->subnodes[i])) continue;
+
+    subnode = node_copy_path(cur->subnodes[i], node, new_node);
+    if (!subnode) continue;
+
+    node_t *new_cur = node_create_with_rule_id(cur->id, cur->rule_id);
+    new_cur->recursion_edge_size = cur->recursion_edge_size;
+    new_cur->non_term_size = cur->non_term_size;
+    node_set_val(new_cur, cur->val_buf, cur->val_len);
+    new_cur->val_len = cur->val_len;
+
+    node_init_subnodes(new_cur, cur->subnode_count);
+    for (uint32_t j = 0; j < cur->subnode_count; ++j)
+      new_cur->subnodes[j] = i == j ? subnode : node_share(cur->subnodes[j]);
+
+    // Parents of shared nodes are left as they are. `subnode` is either a new
+    // copy or `new_node`, so it is never a stored node without a share.
+    if (!__atomic_load_n(&subnode->share_count, __ATOMIC_RELAXED))
+      subnode->parent = new_cur;
+
+    return new_cur;
+
+  }
+
+  return NULL;
+
+}
+
+tree_t *tree_replace_node(tree_t *tree, node_t *node, node_t *new_node) {
+
+  if (!tree || !tree->root || !node || !new_node) return NULL;
+
+  // NOTE: The path is searched from the root, because the parent pointers of
+  //       shared nodes may point into other trees
+  node_t *root = node_copy_path(tree->root, node, new_node);
+  if (!root) return NULL;
+
+  tree_t *new_tree = tree_create();
+  new_tree->root = root;
+  return new_tree;
+
+}
+
 inline bool tree_equal(tree_t *tree_a, tree_t *tree_b) {
 
   if (tree_a == tree_b) return true;
@@ -828,7 +1012,8 @@ tree_t *read_tree_from_file(const char *filename) {
 
 }
 
-tree_t *load_tree_from_test_case(const char *filename) {
+tree_t *load_tree_from_test_case_with(tree_t *base, const char *filename,
+                                      tree_parse_func_t parse) {
 
   tree_t *tree = NULL;
 
@@ -841,6 +1026,7 @@ tree_t *load_tree_from_test_case(const char *filename) {
 
     // error, no file info
     perror("Cannot get file information");
+    close(fd);
     return NULL;
 
   }
@@ -848,6 +1034,7 @@ tree_t *load_tree_from_test_case(const char *filename) {
   size_t   file_size = info.st_size;
   uint8_t *buf =
       (uint8_t *)mmap(0, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
   if (unlikely(buf == MAP_FAILED)) {
 
     perror("Cannot map the test case file to the memory");
@@ -855,23 +1042,27 @@ tree_t *load_tree_from_test_case(const char *filename) {
 
   }
 
-  close(fd);
-
-  // Deserialize the data to recover the tree
-  tree = tree_from_buf(buf, file_size);
+  tree = parse(base, buf, file_size);
   munmap(buf, file_size);
-  if (unlikely(!tree)) {
 
-    // error, cannot parse the data
-    return NULL;
+  return tree;
 
-  }
+}
 
-  return tree;
+tree_t *load_tree_from_test_case_incremental(tree_t *base, const char *filename) {
+
+  return load_tree_from_test_case_with(base, filename,
+                                       tree_from_buf_incremental);
+
+}
+
+tree_t *load_tree_from_test_case(const char *filename) {
+
+  return load_tree_from_test_case_incremental(NULL, filename);
 
 }
 
-void write_tree_to_file(tree_t *tree, const char *filename) {
+bool write_tree_to_file(tree_t *tree, const char *filename) {
 
   int fd, ret;
 
@@ -883,7 +1074,7 @@ void write_tree_to_file(tree_t *tree, const char *filename) {
   if (unlikely(fd < 0)) {
 
     perror("Unable to create the file (write_tree_to_file)");
-    return;
+    return false;
 
   }
 
@@ -892,22 +1083,25 @@ void write_tree_to_file(tree_t *tree, const char *filename) {
   if (unlikely(ret < 0)) {
 
     perror("Unable to write (write_tree_to_file)");
-    return;
+    close(fd);
+    return false;
 
   }
 
   if (unlikely((size_t)ret != tree->ser_len)) {
 
     perror("Short write to tree file (write_tree_to_file)");
-    return;
+    close(fd);
+    return false;
 
   }
 
   close(fd);
+  return true;
 
 }
 
-void dump_tree_to_test_case(tree_t *tree, const char *filename) {
+bool dump_tree_to_test_case(tree_t *tree, const char *filename) {
 
   int fd, ret;
 
@@ -919,7 +1113,7 @@ void dump_tree_to_test_case(tree_t *tree, const char *filename) {
   if (unlikely(fd < 0)) {
 
     perror("Unable to create the file (dump_tree_to_test_case)");
-    exit(EXIT_FAILURE);
+    return false;
 
   }
 
@@ -927,18 +1121,21 @@ void dump_tree_to_test_case(tree_t *tree, const char *filename) {
   ret = write(fd, tree->data_buf, tree->data_len);
   if (unlikely(ret < 0)) {
 
-    perror("Unable to write (write_tree_to_file)");
-    return;
+    perror("Unable to write (dump_tree_to_test_case)");
+    close(fd);
+    return false;
 
   }
 
   if (unlikely((size_t)ret != tree->data_len)) {
 
     perror("Short write to tree file (dump_tree_to_test_case)");
-    return;
+    close(fd);
+    return false;
 
   }
 
   close(fd);
+  return true;
 
 }
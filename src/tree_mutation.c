@@ -19,6 +19,7 @@
 #include "tree_mutation.h"
 #include "f1_c_fuzz.h"
 #include "chunk_store.h"
+#include "gen_cache.h"
 
 static size_t max_tree_len = 1000;
 
@@ -46,10 +47,9 @@ tree_t *random_mutation(tree_t *tree) {
 
   node_t *parent = node->parent;
 
-  // Generate a new node
-  gen_func_t gen_func = gen_funcs[node->id];
-  int        consumed = 0;
-  node_t *   replace_node = gen_func(max_tree_len, &consumed, -1);
+  // Generate a new node, or reuse a recently generated one
+  int     consumed = 0;
+  node_t *replace_node = gen_cache_gen_node(node->id, max_tree_len, &consumed);
 
   if (!parent) {  // no parent, meaning that the picked node is the root node
     // Destroy the original root node
@@ -84,38 +84,14 @@ tree_t *rules_mutation(tree_t *tree, node_t *node, uint32_t rule_id) {
   // Note: this may not be an error case
   if (unlikely(node->rule_id == rule_id)) return NULL;
 
-  tree_t *mutated_tree = NULL;
-  node_t *parent = node->parent;
-
   // Generate a new node
   gen_func_t gen_func = gen_funcs[node->id];
   int        consumed = 0;
   node_t *   replace_node = gen_func(max_tree_len, &consumed, rule_id);
 
-  if (!parent) {
-
-    // no parent, meaning that the input node is the root node in the tree
-    mutated_tree = tree_create();
-    mutated_tree->root = replace_node;
-    return mutated_tree;
-
-  }
-
-  // detach `node` from `parent`
-  edge_t edge = node_get_parent_edge(node);
-  node->parent = NULL;
-
-  // attach `replace_node` to the original position of `node` in `parent`
-  parent->subnodes[edge.subnode_offset] = replace_node;
-  replace_node->parent = parent;
-
-  mutated_tree = tree_clone(tree);
-
-  // recover `tree`
-  parent->subnodes[edge.subnode_offset] = node;
-  node->parent = parent;
-
-  node_free(replace_node);
+  // `tree` is not modified, as it may be shared (e.g., by the chunk store)
+  tree_t *mutated_tree = tree_replace_node(tree, node, replace_node);
+  if (unlikely(!mutated_tree)) node_free(replace_node);
 
   return mutated_tree;
 
@@ -194,12 +170,16 @@ tree_t *random_recursive_mutation(tree_t *tree, uint8_t n) {
 
 tree_t *splicing_mutation(tree_t *tree) {
 
-  if (unlikely(!tree)) return NULL;
+  return splicing_mutation_within(tree, SIZE_MAX);
 
-  tree_t *mutated_tree = tree_clone(tree);
+}
+
+tree_t *splicing_mutation_within(tree_t *tree, size_t max_size) {
+
+  if (unlikely(!tree)) return NULL;
 
   // randomly pick a node in the tree
-  node_t *node = node_pick_non_term_subnode(mutated_tree->root);
+  node_t *node = node_pick_non_term_subnode(tree->root);
   if (unlikely(node == NULL)) {
 
     // By design, _pick_non_term_node should not return NULL
@@ -208,34 +188,35 @@ tree_t *splicing_mutation(tree_t *tree) {
 
   }
 
-  node_t *parent = node->parent;
+  // The rest of the tree is kept, so the subtree may only take what is left of
+  // `max_size`
+  size_t max_len = SIZE_MAX;
+  if (max_size != SIZE_MAX) {
+
+    size_t rest_len =
+        node_get_data_len(tree->root) - node_get_data_len(node);
+    max_len = rest_len < max_size ? max_size - rest_len : 0;
+
+  }
 
   // pick a subtree, in which the root type is the same as the picked node, from
   // the chunk store
-  node_t *replace_node = chunk_store_get_alternative_node(node);
+  node_t *replace_node = chunk_store_get_alternative_node_within(node, max_len);
   if (!replace_node) {
 
     // if there is no alternative node, return the cloned tree
-    return mutated_tree;
-
-  }
-
-  if (!parent) {  // no parent, meaning that the picked node is the root node
-    // Destroy the original root node
-    node_free(node);
-    // Simply set the new root node
-    mutated_tree->root = replace_node;
-    return mutated_tree;
+    return tree_clone(tree);
 
   }
 
-  if (node_replace_subnode(parent, node, replace_node)) {
-
-    node_free(node);
-
-  } else {
+  // Neither the donor nor the unchanged subtrees of `tree` are cloned, so that
+  // the cost does not depend on their sizes. They are copied on write instead,
+  // i.e., when the mutated tree is cloned by later mutations.
+  tree_t *mutated_tree = tree_replace_node(tree, node, replace_node);
+  if (unlikely(!mutated_tree)) {
 
     node_free(replace_node);
+    return tree_clone(tree);
 
   }
 
@@ -21,38 +21,14 @@
 
 tree_t *subtree_trimming(tree_t *tree, node_t *node) {
 
-  tree_t *trimmed_tree = NULL;
-
   // generate the minimal subtree
   gen_func_t gen_func = gen_funcs[node->id];
   int        consumed = 0;
   node_t *   min_node = gen_func(0, &consumed, -1);
 
-  node_t *parent = node->parent;
-  if (!parent) {
-
-    // no parent, meaning that the input node is the root node in the tree
-    trimmed_tree = tree_create();
-    trimmed_tree->root = min_node;
-    return trimmed_tree;
-
-  }
-
-  // detach `node` from `parent`
-  edge_t edge = node_get_parent_edge(node);
-  node->parent = NULL;
-
-  // attach `min_node` to the original position of `node` in `parent`
-  parent->subnodes[edge.subnode_offset] = min_node;
-  min_node->parent = parent;
-
-  trimmed_tree = tree_clone(tree);
-
-  // recover `tree`
-  parent->subnodes[edge.subnode_offset] = node;
-  node->parent = parent;
-
-  node_free(min_node);
+  // `tree` is not modified, as it may be shared (e.g., by the chunk store)
+  tree_t *trimmed_tree = tree_replace_node(tree, node, min_node);
+  if (unlikely(!trimmed_tree)) node_free(min_node);
 
   return trimmed_tree;
 
@@ -72,36 +48,9 @@ tree_t *recursive_trimming(tree_t *tree, edge_t edge) {
 
   }
 
-  node_t *pre_parent = parent->parent;
-  if (!pre_parent) {
-
-    // if `parent` is the root node of the tree, return the tail part
-    trimmed_tree = tree_create();
-    trimmed_tree->root = node_clone(tail);
-    return trimmed_tree;
-
-  }
-
-  // detach `tail` from `parent`
-  tail->parent = NULL;
-
-  // get the edge between `parent` and `pre_parent`
-  edge_t pre_edge = node_get_parent_edge(parent);
-
-  // detach `parent` from `pre_parent`
-  size_t pre_offset = pre_edge.subnode_offset;
-  parent->parent = NULL;
-
-  // attach `tail` to the original position of `parent` in `pre_parent`
-  pre_parent->subnodes[pre_offset] = tail;
-  tail->parent = pre_parent;
-
-  trimmed_tree = tree_clone(tree);
-
-  // recover `tree`
-  pre_parent->subnodes[pre_offset] = parent;
-  parent->parent = pre_parent;
-  tail->parent = parent;
+  // Place `tail` at the position of `parent`, without modifying `tree`
+  trimmed_tree = tree_replace_node(tree, parent, node_share(tail));
+  if (unlikely(!trimmed_tree)) node_free(tail);
 
   return trimmed_tree;
 
@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -124,16 +125,34 @@ char * strrstr(const char * haystack, const char * needle) {
 }
 
 // Random number generators
-static RANDOM_RETURN random_seed[3];
 #define ROTL(d, lrot) ((d << (lrot)) | (d >> (8 * sizeof(d) - (lrot))))
 #define HASH_SEED 0xa5b35705
 
-void random_set_seed(uint64_t seed) {
+// The context used by the global API (one per thread), unless another one is
+// selected by `random_set_state`
+static __thread random_state_t  random_default_state;
+static __thread random_state_t *random_cur_state = NULL;
+
+static inline random_state_t *random_get_state() {
+
+  return likely(random_cur_state) ? random_cur_state : &random_default_state;
+
+}
+
+random_state_t *random_set_state(random_state_t *state) {
 
-  random_seed[0] = XXH64(&seed, sizeof(seed), HASH_SEED);
-  random_seed[1] = random_seed[0] ^ 0x1234567890abcdef;
-  random_seed[2] = (random_seed[0] & 0x1234567890abcdef) ^
-                   (random_seed[1] | 0xfedcba9876543210);
+  random_state_t *prev = random_get_state();
+  random_cur_state = state;
+  return prev;
+
+}
+
+void random_state_set_seed(random_state_t *state, uint64_t seed) {
+
+  state->seed[0] = XXH64(&seed, sizeof(seed), HASH_SEED);
+  state->seed[1] = state->seed[0] ^ 0x1234567890abcdef;
+  state->seed[2] = (state->seed[0] & 0x1234567890abcdef) ^
+                   (state->seed[1] | 0xfedcba9876543210);
 
 }
 
@@ -142,12 +161,12 @@ void random_set_seed(uint64_t seed) {
 //
 // The fastest generator using 64-bit arith., but not suited for huge jobs.
 // Est. capacity = 2^51 bytes. Register pressure = 4. State size = 128 bits.
-RANDOM_RETURN random_next() {
+RANDOM_RETURN random_state_next(random_state_t *state) {
 
-  RANDOM_RETURN xp = random_seed[0];
-  random_seed[0] = 15241094284759029579u * random_seed[1];
-  random_seed[1] = random_seed[1] - xp;
-  random_seed[1] = ROTL(random_seed[1], 27);
+  RANDOM_RETURN xp = state->seed[0];
+  state->seed[0] = 15241094284759029579u * state->seed[1];
+  state->seed[1] = state->seed[1] - xp;
+  state->seed[1] = ROTL(state->seed[1], 27);
   return xp;
 
 }
@@ -156,20 +175,20 @@ RANDOM_RETURN random_next() {
 //
 // 32-bit arithmetic: Good for general purpose use, except for huge jobs.
 // Est. capacity >= 2^53 bytes. Register pressure = 5. State size = 96 bits.
-RANDOM_RETURN random_next() {
-
-  RANDOM_RETURN xp = random_seed[0], yp = random_seed[1], zp = random_seed[2];
-  random_seed[0] = 3323815723u * zp;
-  random_seed[1] = yp - xp;
-  random_seed[1] = ROTL(random_seed[1], 6);
-  random_seed[2] = zp - yp;
-  random_seed[2] = ROTL(random_seed[2], 22);
+RANDOM_RETURN random_state_next(random_state_t *state) {
+
+  RANDOM_RETURN xp = state->seed[0], yp = state->seed[1], zp = state->seed[2];
+  state->seed[0] = 3323815723u * zp;
+  state->seed[1] = yp - xp;
+  state->seed[1] = ROTL(state->seed[1], 6);
+  state->seed[2] = zp - yp;
+  state->seed[2] = ROTL(state->seed[2], 22);
   return xp;
 
 }
 #endif /* WORD_SIZE_64 */
 
-uint32_t random_below(uint32_t limit) {
+uint32_t random_state_below(random_state_t *state, uint32_t limit) {
 
   if (limit <= 1) return 0;
 
@@ -180,10 +199,79 @@ uint32_t random_below(uint32_t limit) {
   uint64_t unbiased_rnd;
   do {
 
-    unbiased_rnd = random_next();
+    unbiased_rnd = random_state_next(state);
 
   } while (unlikely(unbiased_rnd >= (UINT64_MAX - (UINT64_MAX % limit))));
 
   return unbiased_rnd % limit;
 
 }
+
+double random_state_double(random_state_t *state) {
+
+#ifdef WORD_SIZE_64
+  return (double)(random_state_next(state) >> 11) * 0x1.0p-53;
+#else
+  return (double)random_state_next(state) * 0x1.0p-32;
+#endif /* WORD_SIZE_64 */
+
+}
+
+uint32_t random_state_min_below(random_state_t *state, uint32_t num,
+                                uint32_t limit) {
+
+  if (limit <= 1) return 0;
+
+  // `pow` costs about as much as three calls of `random_below`
+  if (num < 4) {
+
+    uint32_t ret = random_state_below(state, limit);
+    for (uint32_t i = 1; i < num; ++i) {
+
+      uint32_t temp = random_state_below(state, limit);
+      if (temp < ret) ret = temp;
+
+    }
+
+    return ret;
+
+  }
+
+  // P(min >= x) = (1 - x)^num, for `num` uniform numbers in [0, 1)
+  double   u = 1.0 - random_state_double(state);  // (0, 1]
+  double   x = 1.0 - pow(u, 1.0 / num);
+  uint32_t ret = (uint32_t)(x * limit);
+
+  return ret < limit ? ret : limit - 1;
+
+}
+
+void random_set_seed(uint64_t seed) {
+
+  random_state_set_seed(random_get_state(), seed);
+
+}
+
+RANDOM_RETURN random_next() {
+
+  return random_state_next(random_get_state());
+
+}
+
+uint32_t random_below(uint32_t limit) {
+
+  return random_state_below(random_get_state(), limit);
+
+}
+
+double random_double() {
+
+  return random_state_double(random_get_state());
+
+}
+
+uint32_t random_min_below(uint32_t num, uint32_t limit) {
+
+  return random_state_min_below(random_get_state(), num, limit);
+
+}
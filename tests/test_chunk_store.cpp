@@ -16,9 +16,20 @@
 
  */
 
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
 #include "f1_c_fuzz.h"
 #include "chunk_store.h"
 #include "../src/chunk_store_internal.h"
+#include "utils.h"
 
 #include "gtest/gtest.h"
 
@@ -31,7 +42,7 @@ class ChunkStoreTest : public ::testing::Test {
 
   void SetUp() override {
 
-    chunk_store_init();
+    chunk_store_init(0);
 
   }
 
@@ -45,16 +56,58 @@ class ChunkStoreTest : public ::testing::Test {
 
 static size_t num_seen_chunks() {
 
-  int num_seen = 0;
-  const char * key;
-  map_iter_t iter = map_iter(&seen_chunks);
-  while ((key = map_next(&seen_chunks, &iter))) {
+  return seen_chunks.size;
 
-    ++num_seen;
+}
 
-  }
+static string read_file(const char *path) {
+
+  ifstream f(path, ios::binary);
+  return string(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+
+}
+
+static void write_file(const char *path, const string &content) {
+
+  ofstream f(path, ios::binary | ios::trunc);
+  f << content;
+
+}
+
+// Chunks are grouped by length, and shorter chunks come first
+static void expect_length_index() {
+
+  for (size_t id = 0; id < chunk_store_num_types; ++id) {
+
+    auto   vector = &chunk_store[id];
+    size_t start = 0;
+    for (size_t b = 0; b < CHUNK_STORE_NUM_BUCKETS; ++b) {
+
+      size_t end = vector->bucket_ends[b];
+      ASSERT_LE(start, end);
+      for (size_t i = start; i < end; ++i) {
+
+        size_t len = node_get_data_len(vector->nodes_buf[i]);
+        EXPECT_EQ(vector->lens_buf[i], len);
+        EXPECT_TRUE(b == 0 || len >= (size_t)1 << (b - 1));
+        EXPECT_TRUE(b == CHUNK_STORE_NUM_BUCKETS - 1 || len < (size_t)1 << b);
+
+      }
+
+      // Each bucket is sorted, starting at its shortest chunk
+      size_t size = end - start, rot = vector->bucket_rots[b];
+      EXPECT_TRUE(rot == 0 || rot < size);
+      for (size_t k = 1; k < size; ++k)
+        EXPECT_LE(vector->lens_buf[start + (rot + k - 1) % size],
+                  vector->lens_buf[start + (rot + k) % size]);
 
-  return num_seen;
+      start = end;
+
+    }
+
+    EXPECT_EQ(start, vector->num_nodes);
+
+  }
 
 }
 
@@ -64,13 +117,11 @@ TEST_F(ChunkStoreTest, SeenChunk) {
   auto node2 = node_clone(node1);
 
   // check the comparator
-  char node1_hash[16+1];
-  hash_node(node1, node1_hash);
-  EXPECT_EQ(map_set(&seen_chunks, node1_hash, node1), 0);
-  char node2_hash[16+1];
-  hash_node(node1, node2_hash);
-  EXPECT_NE(map_get(&seen_chunks, node2_hash), nullptr);
-  EXPECT_EQ(*map_get(&seen_chunks, node2_hash), node1);
+  auto node1_hash = hash_node(node1);
+  EXPECT_TRUE(hash_table_set(&seen_chunks, node1_hash, node1));
+  auto node2_hash = hash_node(node2);
+  EXPECT_NE(hash_table_get(&seen_chunks, node2_hash), nullptr);
+  EXPECT_EQ(*hash_table_get(&seen_chunks, node2_hash), node1);
 
   EXPECT_EQ(num_seen_chunks(), 1);
 
@@ -93,12 +144,10 @@ TEST_F(ChunkStoreTest, AddNode) {
   chunk_store_take_node(node_clone(node2));
   EXPECT_EQ(num_seen_chunks(), 2);
 
-  list_t **p_node_list = map_get(&chunk_store, node_type_str(node1->id));
-  EXPECT_NE(p_node_list, nullptr);
-  list_t *node_list = *p_node_list;
+  ASSERT_LT(node1->id, chunk_store_num_types);
 
-  // We expect only 1 node added to the node1->id matching list:
-  EXPECT_EQ(node_list->size, 1);
+  // We expect only 1 node added to the node1->id matching array:
+  EXPECT_EQ(chunk_store[node1->id].num_nodes, 1);
 
   node_free(node1);
 
@@ -122,10 +171,415 @@ TEST_F(ChunkStoreTest, AddTree) {
 
   chunk_store_add_tree(tree);
   EXPECT_EQ(num_seen_chunks(), 4);
-  list_t **p_node_list = map_get(&chunk_store, node_type_str(node1->id));
-  EXPECT_NE(p_node_list, nullptr);
-  list_t *node_list = *p_node_list;
-  EXPECT_EQ(node_list->size, 2);
+  ASSERT_LT(node1->id, chunk_store_num_types);
+  EXPECT_EQ(chunk_store[node1->id].num_nodes, 2);
+
+  tree_free(tree);
+
+}
+
+TEST_F(ChunkStoreTest, AddTreeSharedSubtrees) {
+
+  auto tree = tree_create();  // "[" + "1" + "1" + "]"
+  auto node1 = node_create(1);
+  auto node2 = node_create_with_val(0, "[", 1);
+  auto node3 = node_create_with_val(1, "1", 1);
+  auto node4 = node_create_with_val(1, "1", 1);
+  auto node5 = node_create_with_val(0, "]", 1);
+
+  node_init_subnodes(node1, 4);
+  node_set_subnode(node1, 0, node2);
+  node_set_subnode(node1, 1, node3);
+  node_set_subnode(node1, 2, node4);
+  node_set_subnode(node1, 3, node5);
+  tree->root = node1;
+
+  // The hash of a subtree does not depend on where it is located
+  auto node3_hash = hash_node(node3);
+  auto node4_hash = hash_node(node4);
+  EXPECT_EQ(node3_hash.low64, node4_hash.low64);
+  EXPECT_EQ(node3_hash.high64, node4_hash.high64);
+
+  chunk_store_add_tree(tree);
+  EXPECT_EQ(num_seen_chunks(), 4);
+
+  // Identical subtrees are stored only once, and shared by the stored root
+  auto p_root = hash_table_get(&seen_chunks, hash_node(node1));
+  ASSERT_NE(p_root, nullptr);
+  auto root = (node_t *)*p_root;
+  ASSERT_EQ(root->subnode_count, 4);
+  EXPECT_EQ(root->subnodes[1], root->subnodes[2]);
+  EXPECT_TRUE(node_equal(root, node1));
+
+  tree_free(tree);
+
+}
+
+TEST_F(ChunkStoreTest, BoundedSize) {
+
+  chunk_store_stats_t stats;
+  size_t              max_size = 64 << 10;
+
+  random_set_seed(0);  // Fix the random seed
+  chunk_store_clear();
+  chunk_store_init(max_size);
+
+  for (int i = 0; i < 1000; ++i) {
+
+    auto tree = gen_init__(1000);
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+
+    chunk_store_get_stats(&stats);
+    ASSERT_LE(stats.size, max_size);
+
+  }
+
+  EXPECT_GT(stats.num_evictions, 0);
+  EXPECT_GT(stats.num_chunks, 0);
+
+  // Evicted chunks are no longer indexed
+  size_t num_chunks = 0;
+  for (size_t id = 0; id < chunk_store_num_types; ++id)
+    num_chunks += chunk_store[id].num_nodes;
+  EXPECT_EQ(num_chunks, stats.num_chunks);
+  EXPECT_EQ(num_seen_chunks(), stats.num_chunks);
+  expect_length_index();
+
+  // Remaining chunks, including their shared subnodes, are still usable
+  auto tree = gen_init__(1000);
+  auto node = chunk_store_get_alternative_node(tree->root);
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->id, tree->root->id);
+  node_free(node);
+  tree_free(tree);
+
+}
+
+TEST_F(ChunkStoreTest, BackgroundWorker) {
+
+  chunk_store_stats_t stats;
+  size_t              max_size = 64 << 10;
+
+  random_set_seed(0);  // Fix the random seed
+  chunk_store_clear();
+  chunk_store_init(max_size);
+  ASSERT_TRUE(chunk_store_start_worker());
+
+  // Picked nodes outlive their eviction by the worker
+  vector<pair<node_t *, string>> picked;
+  for (int i = 0; i < 1000; ++i) {
+
+    auto tree = gen_init__(1000);
+    chunk_store_add_tree(tree);
+
+    auto node = chunk_store_get_alternative_node(tree->root);
+    if (node) {
+
+      auto picked_tree = tree_create();
+      picked_tree->root = node_share(node);
+      tree_to_buf(picked_tree);
+      picked.emplace_back(
+          node, string((char *)picked_tree->data_buf, picked_tree->data_len));
+      tree_free(picked_tree);
+
+    }
+
+    tree_free(tree);
+
+  }
+
+  chunk_store_flush();
+  chunk_store_get_stats(&stats);
+  EXPECT_LE(stats.size, max_size);
+  EXPECT_GT(stats.num_evictions, 0);
+  EXPECT_EQ(num_seen_chunks(), stats.num_chunks);
+  expect_length_index();
+  EXPECT_FALSE(picked.empty());
+
+  // All flushed chunks have been published
+  for (uint32_t id = 1; id < chunk_store_num_types; ++id) {
+
+    if (!chunk_store[id].num_nodes) continue;
+
+    auto node = node_create(id);
+    auto alternative_node = chunk_store_get_alternative_node(node);
+    ASSERT_NE(alternative_node, nullptr);
+    EXPECT_EQ(alternative_node->id, id);
+    node_free(alternative_node);
+    node_free(node);
+
+  }
+
+  chunk_store_clear();
+  for (auto &p : picked) {
+
+    auto picked_tree = tree_create();
+    picked_tree->root = p.first;
+    tree_to_buf(picked_tree);
+    EXPECT_EQ(string((char *)picked_tree->data_buf, picked_tree->data_len),
+              p.second);
+    tree_free(picked_tree);
+
+  }
+
+}
+
+TEST_F(ChunkStoreTest, GetAlternativeNodeWithin) {
+
+  random_set_seed(0);  // Fix the random seed
+  for (int i = 0; i < 100; ++i) {
+
+    auto tree = gen_init__(1000);
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+
+  }
+
+  expect_length_index();
+
+  // The start symbol (1) has chunks of various lengths
+  auto   node = node_create(1);
+  size_t min_len = SIZE_MAX;
+  for (size_t i = 0; i < chunk_store[1].num_nodes; ++i)
+    min_len = min(min_len, chunk_store[1].lens_buf[i]);
+
+  for (size_t max_len = min_len; max_len < 1000; max_len += 7) {
+
+    auto _node = chunk_store_get_alternative_node_within(node, max_len);
+    ASSERT_NE(_node, nullptr);
+    EXPECT_EQ(_node->id, node->id);
+    EXPECT_LE(node_get_data_len(_node), max_len);
+    node_free(_node);
+
+  }
+
+  // No chunk is short enough
+  ASSERT_GT(min_len, 0);
+  EXPECT_EQ(chunk_store_get_alternative_node_within(node, min_len - 1),
+            nullptr);
+
+  node_free(node);
+
+}
+
+TEST_F(ChunkStoreTest, SharedFile) {
+
+  const char *path = "chunk_store_test.shm";
+  unlink(path);
+  ASSERT_TRUE(chunk_store_share(path, 16 << 20));
+
+  // Another process adds a tree to the shared file
+  random_set_seed(0);  // Fix the random seed
+  auto tree = gen_init__(100);
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+
+    chunk_store_add_tree(tree);
+    _exit(0);
+
+  }
+
+  int status;
+  waitpid(pid, &status, 0);
+  ASSERT_TRUE(WIFEXITED(status));
+
+  chunk_store_stats_t stats;
+  chunk_store_get_stats(&stats);
+  EXPECT_GT(stats.num_chunks, 0);
+
+  // Chunks are picked from the shared file
+  auto node = chunk_store_get_alternative_node(tree->root);
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->id, tree->root->id);
+  node_free(node);
+
+  // Adding the same tree again does not store anything
+  chunk_store_add_tree(tree);
+  size_t num_chunks = stats.num_chunks;
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_chunks, num_chunks);
+  EXPECT_EQ(stats.num_full, 0);
+
+  tree_free(tree);
+  unlink(path);
+
+}
+
+TEST_F(ChunkStoreTest, SharedFileFull) {
+
+  const char *path = "chunk_store_test.shm";
+  unlink(path);
+
+  // A file of another grammar is rejected
+  uint32_t num_types = sizeof(gen_funcs) / sizeof(gen_funcs[0]);
+  ASSERT_TRUE(
+      shared_chunk_store_open(path, 1 << 20, num_types, GEN_GRAMMAR_HASH + 1));
+  shared_chunk_store_close();
+  EXPECT_FALSE(chunk_store_share(path, 1 << 20));
+  unlink(path);
+
+  // Trees that do not fit anymore are counted
+  ASSERT_TRUE(chunk_store_share(path, 1 << 20));
+  chunk_store_stats_t stats;
+  for (int i = 0; i < 1000; ++i) {
+
+    random_set_seed(i);
+    auto tree = gen_init__(1000);
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+
+    chunk_store_get_stats(&stats);
+    if (stats.num_full) break;
+
+  }
+
+  EXPECT_GT(stats.num_full, 0);
+  EXPECT_GT(stats.num_chunks, 0);
+
+  // The stored chunks can still be picked
+  auto tree = gen_init__(1000);
+  auto node = chunk_store_get_alternative_node(tree->root);
+  ASSERT_NE(node, nullptr);
+  node_free(node);
+  tree_free(tree);
+  unlink(path);
+
+}
+
+TEST_F(ChunkStoreTest, SaveAndLoad) {
+
+  const char *path = "chunk_store_test.snapshot";
+  chunk_store_stats_t stats;
+
+  random_set_seed(0);  // Fix the random seed
+  auto tree = gen_init__(1000);
+  chunk_store_add_tree(tree);
+  auto hash = hash_node(tree->root);
+  chunk_store_get_stats(&stats);
+  size_t num_chunks = stats.num_chunks;
+  size_t size = stats.size;
+  ASSERT_TRUE(chunk_store_save(path));
+
+  chunk_store_clear();
+  chunk_store_init(0);
+  ASSERT_TRUE(chunk_store_load(path));
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_chunks, num_chunks);
+  EXPECT_EQ(stats.size, size);
+
+  auto p_root = hash_table_get(&seen_chunks, hash);
+  ASSERT_NE(p_root, nullptr);
+  EXPECT_TRUE(node_equal((node_t *)*p_root, tree->root));
+
+  // Loading the same chunks again does not store anything
+  ASSERT_TRUE(chunk_store_load(path));
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_chunks, num_chunks);
+  EXPECT_EQ(stats.size, size);
+
+  // Truncated or corrupt snapshots are rejected
+  string snapshot = read_file(path);
+  ASSERT_GT(snapshot.size(), sizeof(chunk_store_snapshot_header_t) +
+                                 sizeof(chunk_store_snapshot_record_t));
+  write_file(path, snapshot.substr(0, snapshot.size() - 1));
+  EXPECT_FALSE(chunk_store_load(path));
+
+  string corrupt = snapshot;
+  auto   header = (chunk_store_snapshot_header_t *)&corrupt[0];
+  header->grammar_hash ^= 1;
+  write_file(path, corrupt);
+  EXPECT_FALSE(chunk_store_load(path));
+
+  // The first record is a terminal node
+  corrupt = snapshot;
+  auto record = (chunk_store_snapshot_record_t *)&corrupt[sizeof(*header)];
+  record->id = chunk_store_num_types;
+  write_file(path, corrupt);
+  EXPECT_FALSE(chunk_store_load(path));
+
+  corrupt = snapshot;
+  record = (chunk_store_snapshot_record_t *)&corrupt[sizeof(*header)];
+  record->rule_id = 1;
+  write_file(path, corrupt);
+  EXPECT_FALSE(chunk_store_load(path));
+
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_chunks, num_chunks);
+  EXPECT_EQ(stats.size, size);
+
+  tree_free(tree);
+  unlink(path);
+
+  EXPECT_FALSE(chunk_store_load(path));
+
+}
+
+TEST_F(ChunkStoreTest, Stats) {
+
+  const char *        path = "chunk_store_test.stats";
+  chunk_store_stats_t stats;
+
+  random_set_seed(0);  // Fix the random seed
+  auto tree = gen_init__(1000);
+  chunk_store_add_tree(tree);
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_added_trees, 1);
+  EXPECT_GE(stats.num_added_nodes, stats.num_chunks);
+  size_t num_added_nodes = stats.num_added_nodes;
+  size_t num_duplicates = stats.num_duplicates;
+
+  // Every subtree of the same tree is a duplicate
+  chunk_store_add_tree(tree);
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_added_trees, 2);
+  EXPECT_EQ(stats.num_added_nodes, 2 * num_added_nodes);
+  EXPECT_EQ(stats.num_duplicates, num_duplicates + num_added_nodes);
+
+  // Chunk lengths and counts per node type add up
+  size_t total_len = 0;
+  for (size_t id = 0; id < chunk_store_num_types; ++id)
+    for (size_t i = 0; i < chunk_store[id].num_nodes; ++i)
+      total_len += chunk_store[id].lens_buf[i];
+  EXPECT_EQ(stats.total_len, total_len);
+
+  size_t num_types = chunk_store_num_types + 1;
+  vector<size_t> num_chunks(num_types);
+  chunk_store_get_type_stats(num_chunks.data(), num_types);
+  EXPECT_EQ(num_chunks[tree->root->id], 1);
+  EXPECT_EQ(num_chunks[chunk_store_num_types], 0);
+  size_t total_chunks = 0;
+  for (auto n : num_chunks)
+    total_chunks += n;
+  EXPECT_EQ(total_chunks, stats.num_chunks);
+
+  // Requests without an alternative node are misses
+  auto node = chunk_store_get_alternative_node(tree->root);
+  node_free(node);
+  auto missing_node = node_create(chunk_store_num_types);
+  EXPECT_EQ(chunk_store_get_alternative_node(missing_node), nullptr);
+  node_free(missing_node);
+  chunk_store_get_stats(&stats);
+  EXPECT_EQ(stats.num_lookups, 2);
+  EXPECT_EQ(stats.num_misses, 1);
+
+  ASSERT_TRUE(chunk_store_write_stats(path));
+  FILE *f = fopen(path, "r");
+  ASSERT_NE(f, nullptr);
+  char   line[256];
+  string content;
+  while (fgets(line, sizeof(line), f))
+    content += line;
+  fclose(f);
+  unlink(path);
+
+  EXPECT_NE(content.find("chunks            : " + to_string(stats.num_chunks)),
+            string::npos);
+  EXPECT_NE(content.find("splice_misses     : 1\n"), string::npos);
+  EXPECT_NE(content.find("dedup_hit_rate    : "), string::npos);
+  EXPECT_NE(content.find(string("chunks_") + node_type_str(tree->root->id)),
+            string::npos);
 
   tree_free(tree);
 
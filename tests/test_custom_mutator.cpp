@@ -47,6 +47,17 @@ static void dump_test_case(uint8_t *buf, size_t buf_size) {
 
 #endif
 
+// afl-fuzz writes a new queue entry before `afl_custom_queue_new_entry`
+static void write_test_case(const string &fn, const uint8_t *buf,
+                            size_t buf_size) {
+
+  FILE *f = fopen(fn.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  EXPECT_EQ(fwrite(buf, 1, buf_size, f), buf_size);
+  fclose(f);
+
+}
+
 class CustomMutatorTest : public ::testing::Test {
 
  protected:
@@ -116,8 +127,8 @@ class CustomMutatorTest : public ::testing::Test {
 
 TEST_F(CustomMutatorTest, Fuzzing) {
 
-  uint8_t *                      buf = nullptr;
-  __attribute__((unused)) size_t buf_size;
+  uint8_t *buf = nullptr;
+  size_t   buf_size;
 
   // prepare a tree
   auto tree = gen_init__(0);
@@ -144,6 +155,7 @@ TEST_F(CustomMutatorTest, Fuzzing) {
                                &buf, nullptr, 0, 4096);
     EXPECT_NE(buf, nullptr);
     string fn_new = "afl_test_fuzz_out/queue/fuzz_0_" + to_string(i);
+    write_test_case(fn_new, buf, buf_size);
     afl_custom_queue_new_entry(
         mutator->data, (const uint8_t *)fn_new.c_str(),
         (const uint8_t *)"afl_test_fuzz_out/queue/fuzz_0");
@@ -159,6 +171,44 @@ TEST_F(CustomMutatorTest, Fuzzing) {
 
 }
 
+TEST_F(CustomMutatorTest, QueueNewEntryFromHavoc) {
+
+  uint8_t *buf = nullptr;
+
+  auto tree = gen_init__(100);
+  dump_tree_to_test_case(tree, "afl_test_fuzz_out/queue/fuzz_0");
+  write_tree_to_file(tree, "afl_test_fuzz_out/trees/fuzz_0");
+  ASSERT_EQ(afl_custom_queue_get(
+                mutator->data, (const uint8_t *)"afl_test_fuzz_out/queue/fuzz_0"),
+            1);
+
+  // The custom stage leaves its last (uninteresting) mutant behind
+  tree_to_buf(tree);
+  ASSERT_GT(afl_custom_fuzz_count(mutator->data, nullptr, 0), 0);
+  afl_custom_fuzz(mutator->data, tree->data_buf, tree->data_len, &buf, nullptr,
+                  0, 4096);
+  ASSERT_NE(mutator->data->mutated_tree, nullptr);
+
+  // A havoc mutant of the same seed is saved with its own tree
+  string havoc((char *)tree->data_buf, tree->data_len);
+  havoc += " ";
+  write_test_case("afl_test_fuzz_out/queue/fuzz_0_havoc",
+                  (const uint8_t *)havoc.data(), havoc.size());
+  afl_custom_queue_new_entry(
+      mutator->data, (const uint8_t *)"afl_test_fuzz_out/queue/fuzz_0_havoc",
+      (const uint8_t *)"afl_test_fuzz_out/queue/fuzz_0");
+  EXPECT_EQ(mutator->data->mutated_tree, nullptr);
+
+  auto saved_tree = read_tree_from_file("afl_test_fuzz_out/trees/fuzz_0_havoc");
+  ASSERT_NE(saved_tree, nullptr);
+  tree_to_buf(saved_tree);
+  EXPECT_EQ(string((char *)saved_tree->data_buf, saved_tree->data_len), havoc);
+
+  tree_free(saved_tree);
+  tree_free(tree);
+
+}
+
 TEST_F(CustomMutatorTest, FuzzingParsingError) {
 
   uint8_t *                      buf = nullptr;
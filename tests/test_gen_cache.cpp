@@ -0,0 +1,140 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+
+#include "f1_c_fuzz.h"
+#include "gen_cache.h"
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+// The start symbol is the first node type of any grammar
+#define START_NODE_ID (1)
+
+class GenCacheTest : public ::testing::Test {
+
+ protected:
+  gen_cache_stats_t stats;
+
+  void SetUp() override {
+
+    random_set_seed(0);
+
+  }
+
+  void TearDown() override {
+
+    gen_cache_clear();
+
+  }
+
+};
+
+TEST_F(GenCacheTest, Disabled) {
+
+  gen_cache_init(0, 0);
+
+  int  consumed = 0;
+  auto node = gen_cache_gen_node(START_NODE_ID, 100, &consumed);
+  ASSERT_NE(node, nullptr);
+  EXPECT_EQ(node->id, START_NODE_ID);
+  node_free(node);
+
+  gen_cache_get_stats(&stats);
+  EXPECT_EQ(stats.hits, 0u);
+  EXPECT_EQ(stats.misses, 0u);
+
+}
+
+TEST_F(GenCacheTest, HitsAfterReservoirIsFull) {
+
+  gen_cache_init(4, 0);
+
+  for (int i = 0; i < 10; ++i) {
+
+    int  consumed = 0;
+    auto node = gen_cache_gen_node(START_NODE_ID, 100, &consumed);
+    ASSERT_NE(node, nullptr);
+    EXPECT_EQ(node->id, START_NODE_ID);
+    EXPECT_LE(consumed, 100);
+    node_free(node);
+
+  }
+
+  gen_cache_get_stats(&stats);
+  EXPECT_EQ(stats.misses, 4u);
+  EXPECT_EQ(stats.hits, 6u);
+  EXPECT_EQ(stats.num_nodes, 4u);
+
+  // Another `max_len` empties the reservoir, so that cached subtrees are
+  // always generated with the requested `max_len`
+  int  consumed = 0;
+  auto node = gen_cache_gen_node(START_NODE_ID, 10, &consumed);
+  EXPECT_LE(consumed, 10);
+  node_free(node);
+  gen_cache_get_stats(&stats);
+  EXPECT_EQ(stats.misses, 5u);
+  EXPECT_EQ(stats.num_nodes, 1u);
+
+}
+
+TEST_F(GenCacheTest, AlwaysRefresh) {
+
+  gen_cache_init(4, 1);
+
+  for (int i = 0; i < 10; ++i) {
+
+    int consumed = 0;
+    node_free(gen_cache_gen_node(START_NODE_ID, 100, &consumed));
+
+  }
+
+  gen_cache_get_stats(&stats);
+  EXPECT_EQ(stats.hits, 0u);
+  EXPECT_EQ(stats.misses, 10u);
+  EXPECT_EQ(stats.num_nodes, 4u);
+
+}
+
+TEST_F(GenCacheTest, ClonesAreIndependent) {
+
+  gen_cache_init(1, 0);
+
+  int  consumed = 0;
+  auto node1 = gen_cache_gen_node(START_NODE_ID, 100, &consumed);
+  auto node2 = gen_cache_gen_node(START_NODE_ID, 100, &consumed);
+  ASSERT_NE(node1, node2);
+  EXPECT_TRUE(node_equal(node1, node2));
+
+  // Freeing a returned subtree does not affect the cached one
+  node_free(node1);
+  auto node3 = gen_cache_gen_node(START_NODE_ID, 100, &consumed);
+  EXPECT_TRUE(node_equal(node2, node3));
+  node_free(node2);
+  node_free(node3);
+
+}
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,121 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include "hash_table.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+class HashTableTest : public ::testing::Test {
+
+ protected:
+  hash_table_t table;
+
+  void SetUp() override {
+
+    ASSERT_TRUE(hash_table_init(&table, 0));
+
+  }
+
+  void TearDown() override {
+
+    hash_table_deinit(&table);
+
+  }
+
+};
+
+// Keys in the same slot, so that all of them are in one probe sequence
+static hash_key_t colliding_key(uint64_t i) {
+
+  return hash_key_t{0, i};
+
+}
+
+TEST_F(HashTableTest, SetAndGet) {
+
+  int values[3];
+
+  EXPECT_EQ(hash_table_get(&table, colliding_key(1)), nullptr);
+
+  EXPECT_TRUE(hash_table_set(&table, colliding_key(1), &values[0]));
+  EXPECT_TRUE(hash_table_set(&table, colliding_key(2), &values[1]));
+  EXPECT_EQ(table.size, 2);
+  EXPECT_EQ(*hash_table_get(&table, colliding_key(1)), &values[0]);
+  EXPECT_EQ(*hash_table_get(&table, colliding_key(2)), &values[1]);
+
+  // Update an existing key
+  EXPECT_TRUE(hash_table_set(&table, colliding_key(1), &values[2]));
+  EXPECT_EQ(table.size, 2);
+  EXPECT_EQ(*hash_table_get(&table, colliding_key(1)), &values[2]);
+
+  // NULL values are reserved for empty slots
+  EXPECT_FALSE(hash_table_set(&table, colliding_key(3), nullptr));
+
+}
+
+TEST_F(HashTableTest, Remove) {
+
+  int values[5];
+
+  for (uint64_t i = 0; i < 5; ++i)
+    ASSERT_TRUE(hash_table_set(&table, colliding_key(i), &values[i]));
+
+  // The following keys in the probe sequence must stay reachable
+  EXPECT_TRUE(hash_table_remove(&table, colliding_key(1)));
+  EXPECT_FALSE(hash_table_remove(&table, colliding_key(1)));
+  EXPECT_EQ(table.size, 4);
+  EXPECT_EQ(hash_table_get(&table, colliding_key(1)), nullptr);
+  for (uint64_t i = 0; i < 5; ++i) {
+
+    if (i == 1) continue;
+    ASSERT_NE(hash_table_get(&table, colliding_key(i)), nullptr);
+    EXPECT_EQ(*hash_table_get(&table, colliding_key(i)), &values[i]);
+
+  }
+
+}
+
+TEST_F(HashTableTest, Resize) {
+
+  size_t num = 100000;
+  for (size_t i = 0; i < num; ++i)
+    ASSERT_TRUE(hash_table_set(&table, hash_key_t{i * 7919, i}, &table));
+
+  EXPECT_EQ(table.size, num);
+  EXPECT_LT(table.size * 4, table.capacity * 3);
+  for (size_t i = 0; i < num; ++i)
+    ASSERT_NE(hash_table_get(&table, hash_key_t{i * 7919, i}), nullptr);
+  EXPECT_EQ(hash_table_get(&table, hash_key_t{1, num}), nullptr);
+
+  for (size_t i = 0; i < num; i += 2)
+    ASSERT_TRUE(hash_table_remove(&table, hash_key_t{i * 7919, i}));
+  EXPECT_EQ(table.size, num / 2);
+  for (size_t i = 0; i < num; ++i)
+    EXPECT_EQ(hash_table_get(&table, hash_key_t{i * 7919, i}) != nullptr,
+              i % 2 == 1);
+
+}
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+
+}
@@ -0,0 +1,197 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "f1_c_fuzz.h"
+#include "parse_cache.h"
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+class ParseCacheTest : public ::testing::Test {
+
+ protected:
+  string  cache_dir = "parse_cache_test_out";
+  tree_t *tree = nullptr;
+
+  void SetUp() override {
+
+    tree = gen_init__(100);
+    tree_to_buf(tree);
+
+  }
+
+  void TearDown() override {
+
+    parse_cache_clear();
+    remove_directory(cache_dir.c_str());
+
+    tree_free(tree);
+    tree = nullptr;
+
+  }
+
+};
+
+// The files in the cache directory of this grammar
+static vector<string> list_cache_files(const string &cache_dir) {
+
+  char dir_path[4096];
+  snprintf(dir_path, sizeof(dir_path), "%s/%016llX", cache_dir.c_str(),
+           (unsigned long long)GEN_GRAMMAR_HASH);
+
+  vector<string> files;
+  DIR *          dir = opendir(dir_path);
+  if (!dir) return files;
+
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr)
+    if (ent->d_name[0] != '.')
+      files.push_back(string(dir_path) + "/" + ent->d_name);
+  closedir(dir);
+  return files;
+
+}
+
+TEST_F(ParseCacheTest, GetAfterAdd) {
+
+  parse_cache_init(nullptr, 1 << 20, 0);
+
+  EXPECT_EQ(parse_cache_get(tree->data_buf, tree->data_len), nullptr);
+
+  parse_cache_add(tree->data_buf, tree->data_len, tree);
+  auto cached_tree = parse_cache_get(tree->data_buf, tree->data_len);
+  ASSERT_NE(cached_tree, nullptr);
+  EXPECT_TRUE(tree_equal(tree, cached_tree));
+  tree_free(cached_tree);
+
+}
+
+TEST_F(ParseCacheTest, BoundedSize) {
+
+  // No room for any entry in memory
+  parse_cache_init(nullptr, 0, 0);
+
+  parse_cache_add(tree->data_buf, tree->data_len, tree);
+  EXPECT_EQ(parse_cache_get(tree->data_buf, tree->data_len), nullptr);
+  parse_cache_clear();
+
+  // Many more entries than the cache can hold, which evicts the oldest ones
+  parse_cache_init(nullptr, 1 << 12, 0);
+
+  vector<string> keys;
+  for (int i = 0; i < 1000; ++i) {
+
+    keys.push_back("test case " + to_string(i));
+    parse_cache_add((const uint8_t *)keys.back().data(), keys.back().size(),
+                    tree);
+
+  }
+
+  EXPECT_EQ(parse_cache_get((const uint8_t *)keys.front().data(),
+                            keys.front().size()),
+            nullptr);
+
+  auto cached_tree = parse_cache_get((const uint8_t *)keys.back().data(),
+                                     keys.back().size());
+  ASSERT_NE(cached_tree, nullptr);
+  EXPECT_TRUE(tree_equal(tree, cached_tree));
+  tree_free(cached_tree);
+
+}
+
+TEST_F(ParseCacheTest, SharedDirectory) {
+
+  parse_cache_init(cache_dir.c_str(), 1 << 20, 0);
+  parse_cache_add(tree->data_buf, tree->data_len, tree);
+  parse_cache_clear();
+
+  // Another process only sees the on-disk entries
+  parse_cache_init(cache_dir.c_str(), 0, 0);
+  auto cached_tree = parse_cache_get(tree->data_buf, tree->data_len);
+  ASSERT_NE(cached_tree, nullptr);
+  EXPECT_TRUE(tree_equal(tree, cached_tree));
+  tree_free(cached_tree);
+
+}
+
+TEST_F(ParseCacheTest, SharedDirectoryMismatch) {
+
+  parse_cache_init(cache_dir.c_str(), 1 << 20, 0);
+  parse_cache_add(tree->data_buf, tree->data_len, tree);
+  parse_cache_clear();
+
+  // The tree on disk is not the tree of the test case anymore
+  auto files = list_cache_files(cache_dir);
+  ASSERT_EQ(files.size(), 1);
+  random_set_seed(1);
+  auto other_tree = gen_init__(1000);
+  tree_to_buf(other_tree);
+  ASSERT_FALSE(tree->data_len == other_tree->data_len &&
+               memcmp(tree->data_buf, other_tree->data_buf, tree->data_len) ==
+                   0);
+  write_tree_to_file(other_tree, files[0].c_str());
+  tree_free(other_tree);
+
+  parse_cache_init(cache_dir.c_str(), 0, 0);
+  EXPECT_EQ(parse_cache_get(tree->data_buf, tree->data_len), nullptr);
+
+}
+
+TEST_F(ParseCacheTest, BoundedDirectory) {
+
+  size_t dir_max_size = 16 << 10;
+  parse_cache_init(cache_dir.c_str(), 0, dir_max_size);
+
+  vector<string> keys;
+  for (int i = 0; i < 1000; ++i) {
+
+    keys.push_back("test case " + to_string(i));
+    parse_cache_add((const uint8_t *)keys.back().data(), keys.back().size(),
+                    tree);
+
+  }
+
+  // The oldest files are removed, once the directory grows by 1/8
+  size_t total_size = 0;
+  for (auto &file : list_cache_files(cache_dir)) {
+
+    struct stat info;
+    ASSERT_EQ(stat(file.c_str(), &info), 0);
+    total_size += info.st_size;
+
+  }
+
+  EXPECT_GT(total_size, 0);
+  EXPECT_LE(total_size, dir_max_size + dir_max_size / 8 + tree->ser_len);
+
+}
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+
+}
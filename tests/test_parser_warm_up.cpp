@@ -0,0 +1,59 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+#include "f1_c_fuzz.h"
+#include "parser_warm_up.h"
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+TEST(ParserWarmUpTest, Generated) {
+
+  random_set_seed(0);  // Fix the random seed
+
+  // Generated samples always follow the grammar
+  size_t num_rules = 0;
+  for (size_t i = 0; i < sizeof(node_num_rules) / sizeof(node_num_rules[0]);
+       ++i)
+    num_rules += node_num_rules[i];
+
+  EXPECT_EQ(parser_warm_up_generated(2, 10), 2 * num_rules);
+  EXPECT_EQ(parser_warm_up_generated(0, 10), 0);
+
+  // Warming up does not consume the random numbers of the caller
+  random_set_seed(1);
+  auto expected = random_next();
+  random_set_seed(1);
+  parser_warm_up_generated(1, 10);
+  EXPECT_EQ(random_next(), expected);
+
+}
+
+TEST(ParserWarmUpTest, MissingDirectory) {
+
+  EXPECT_EQ(parser_warm_up_from_dir(nullptr), 0);
+  EXPECT_EQ(parser_warm_up_from_dir("parser_warm_up_missing_dir"), 0);
+
+}
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+
+}
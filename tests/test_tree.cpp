@@ -16,8 +16,14 @@
 
  */
 
+#include <set>
+#include <string>
+#include <vector>
+
 #include "tree.h"
+#include "tree_mutation.h"
 #include "f1_c_fuzz.h"
+#include "utils.h"
 
 #include "gtest/gtest.h"
 #include "gtest_ext.h"
@@ -250,6 +256,136 @@ TEST_F(TreeTest, ParseTreeFromBuffer) {
 
 }
 
+TEST_F(TreeTest, ParseTreeWithLexerPrefilter) {
+
+  // A generated test case has no invalid tokens at all
+  tree_set_max_invalid_token_ratio(0.0);
+
+  tree_t *tree2 = gen_init__(100);
+  tree_to_buf(tree2);
+  tree_t *recovered_tree2 = tree_from_buf(tree2->data_buf, tree2->data_len);
+  EXPECT_NE(recovered_tree2, nullptr);
+  tree_free(tree2);
+  tree_free(recovered_tree2);
+
+  // Control characters are not in any token of the grammar, so that the lexer
+  // skips them one by one
+  std::string unlexable = "{" + std::string(100, '\x01') + "}";
+  tree_set_max_invalid_token_ratio(0.5);
+  tree_t *rejected_tree =
+      tree_from_buf((const uint8_t *)unlexable.data(), unlexable.size());
+  EXPECT_EQ(rejected_tree, nullptr);
+  tree_free(rejected_tree);
+
+  // The parser recovers from the errors, if the prefilter is disabled
+  tree_set_max_invalid_token_ratio(1.0);
+  tree_t *recovered_tree3 =
+      tree_from_buf((const uint8_t *)unlexable.data(), unlexable.size());
+  EXPECT_NE(recovered_tree3, nullptr);
+  tree_free(recovered_tree3);
+
+}
+
+TEST_F(TreeTest, ParseTreeIncrementally) {
+
+  tree_t *base = gen_init__(100);
+  tree_get_size(base);
+  tree_to_buf(base);
+
+  // Unmodified test case
+  tree_t *tree = tree_from_buf_incremental(base, base->data_buf, base->data_len);
+  EXPECT_TRUE(tree_equal(base, tree));
+  tree_free(tree);
+
+  // Modified test case, which should still unparse to the same bytes
+  tree_t *mutated_tree = random_mutation(base);
+  tree_to_buf(mutated_tree);
+  tree = tree_from_buf_incremental(base, mutated_tree->data_buf,
+                                   mutated_tree->data_len);
+  ASSERT_NE(tree, nullptr);
+  tree_to_buf(tree);
+  EXPECT_EQ(tree->data_len, mutated_tree->data_len);
+  EXPECT_MEMEQ(tree->data_buf, mutated_tree->data_buf, tree->data_len);
+  tree_free(tree);
+  tree_free(mutated_tree);
+
+  // Regenerate a subtree that has a sibling, so that the re-parsed region does
+  // not cover the whole test case
+  random_set_seed(1);
+  tree_get_non_terminal_nodes(base);
+  mutated_tree = nullptr;
+  for (list_node_t *entry = base->non_terminal_node_list->head;
+       entry && !mutated_tree; entry = entry->next) {
+
+    node_t *node = (node_t *)entry->data;
+    if (!node->parent || node->parent->subnode_count < 2) continue;
+
+    for (int i = 0; i < 10; ++i) {
+
+      int     consumed = 0;
+      node_t *new_node = gen_funcs[node->id](100, &consumed, -1);
+      mutated_tree = tree_replace_node(base, node, new_node);
+      tree_to_buf(mutated_tree);
+      if (mutated_tree->data_len != base->data_len ||
+          memcmp(mutated_tree->data_buf, base->data_buf, base->data_len) != 0)
+        break;
+
+      tree_free(mutated_tree);
+      mutated_tree = nullptr;
+
+    }
+
+  }
+
+  ASSERT_NE(mutated_tree, nullptr);
+
+  tree = tree_from_buf_incremental(base, mutated_tree->data_buf,
+                                   mutated_tree->data_len);
+  ASSERT_NE(tree, nullptr);
+  tree_to_buf(tree);
+  EXPECT_EQ(tree->data_len, mutated_tree->data_len);
+  EXPECT_MEMEQ(tree->data_buf, mutated_tree->data_buf, tree->data_len);
+
+  // The subtrees outside of the re-parsed region are shared with `base`
+  std::set<node_t *> base_nodes;
+  std::vector<node_t *> stack{base->root};
+  while (!stack.empty()) {
+
+    node_t *cur = stack.back();
+    stack.pop_back();
+    base_nodes.insert(cur);
+    for (uint32_t i = 0; i < cur->subnode_count; ++i)
+      stack.push_back(cur->subnodes[i]);
+
+  }
+
+  EXPECT_EQ(base_nodes.count(tree->root), 0);
+  size_t num_shared = 0;
+  stack.push_back(tree->root);
+  while (!stack.empty()) {
+
+    node_t *cur = stack.back();
+    stack.pop_back();
+    if (base_nodes.count(cur)) {
+
+      ++num_shared;
+      continue;
+
+    }
+
+    for (uint32_t i = 0; i < cur->subnode_count; ++i)
+      stack.push_back(cur->subnodes[i]);
+
+  }
+
+  EXPECT_GT(num_shared, 0);
+
+  tree_free(tree);
+  tree_free(mutated_tree);
+  tree_free(base);
+
+}
+
 TEST_F(TreeTest, ClonedTreeShouldEqual) {
 
   tree_t *new_tree = tree_clone(tree);
@@ -321,6 +457,40 @@ TEST_F(TreeTest, ReplaceNode) {
 
 }
 
+TEST_F(TreeTest, TreeReplaceNodeSharesSubtrees) {
+
+  auto _node = node_create_with_rule_id(1, 0);
+  node_init_subnodes(_node, 1);
+  node_set_subnode(_node, 0, node_create_with_val(0, "null", 4));
+
+  auto tree1 = tree_replace_node(tree, node3, _node);
+  ASSERT_NE(tree1, nullptr);
+  tree_to_buf(tree1);
+  EXPECT_EQ(memcmp("{{null}}", tree1->data_buf, tree1->data_len), 0);
+
+  // Only the path to the replaced node is copied
+  EXPECT_NE(tree1->root, node1);
+  EXPECT_EQ(tree1->root->subnodes[0], node2);
+  EXPECT_EQ(tree1->root->subnodes[2], node4);
+
+  // The original tree is not modified
+  tree_to_buf(tree);
+  EXPECT_EQ(memcmp("{{123}}", tree->data_buf, tree->data_len), 0);
+
+  // A node that is not in the tree cannot be replaced
+  auto _node2 = node_create(1);
+  EXPECT_EQ(tree_replace_node(tree, _node2, _node2), nullptr);
+  node_free(_node2);
+
+  // Shared subtrees outlive the original tree
+  tree_free(tree);
+  tree = nullptr;
+  tree_to_buf(tree1);
+  EXPECT_EQ(memcmp("{{null}}", tree1->data_buf, tree1->data_len), 0);
+  tree_free(tree1);
+
+}
+
 TEST_F(TreeTest, PickNonTermNodeNeverNull) {
 
   node_t *picked_node = nullptr;
@@ -471,6 +641,148 @@ TEST_F(TreeTest, TreeSerializeDeserialize) {
 
 }
 
+TEST_F(TreeTest, CheapTreesDoNotShareNodes) {
+
+  int consumed = 0;
+  for (size_t id = 1; id < sizeof(gen_funcs) / sizeof(gen_funcs[0]); ++id) {
+
+    if (node_min_lens[id] == 0) continue;
+
+    // Trees smaller than the minimal cost are cloned from the same pool
+    random_set_seed(id);
+    tree_t *tree1 = tree_create();
+    tree1->root = gen_funcs[id](0, &consumed, -1);
+    ASSERT_NE(tree1->root, nullptr);
+    tree_to_buf(tree1);
+
+    random_set_seed(id);
+    tree_t *tree2 = tree_create();
+    tree2->root = gen_funcs[id](0, &consumed, -1);
+    ASSERT_NE(tree1->root, tree2->root);
+    EXPECT_TRUE(tree_equal(tree1, tree2));
+
+    // Modifying a generated tree must not affect the pool
+    node_set_val(tree2->root, "modified", 8);
+    tree_free(tree2);
+
+    random_set_seed(id);
+    tree_t *tree3 = tree_create();
+    tree3->root = gen_funcs[id](0, &consumed, -1);
+    EXPECT_TRUE(tree_equal(tree1, tree3));
+
+    tree_free(tree3);
+    tree_free(tree1);
+
+  }
+
+}
+
+TEST_F(TreeTest, GenerateBytesWithoutTree) {
+
+  uint8_t *buf = nullptr;
+  size_t   buf_size = 0;
+  for (int max_len = 0; max_len <= 1000; max_len += 100) {
+
+    random_set_seed(max_len);
+    tree_t *tree1 = gen_init__(max_len);
+    tree_to_buf(tree1);
+
+    random_set_seed(max_len);
+    size_t len = gen_init_bytes__(max_len, &buf, &buf_size);
+    ASSERT_EQ(len, tree1->data_len);
+    EXPECT_EQ(memcmp(buf, tree1->data_buf, len), 0);
+
+    tree_free(tree1);
+
+  }
+
+  free(buf);
+
+}
+
+TEST_F(TreeTest, GenerateBoltzmann) {
+
+  // Targets above the shortest tree of the grammar, which is generated for
+  // any shorter target
+  int    min_len = node_min_lens[1] > 10 ? (int)node_min_lens[1] : 10;
+  double avg_lens[2] = {0, 0};
+  int    target_lens[2] = {4 * min_len, 40 * min_len};
+  for (int i = 0; i < 2; ++i) {
+
+    random_set_seed(i);
+    for (int j = 0; j < 100; ++j) {
+
+      tree_t *tree = gen_init_boltzmann__(target_lens[i]);
+      ASSERT_NE(tree, nullptr);
+      ASSERT_NE(tree->root, nullptr);
+      EXPECT_EQ(tree->root->id, 1u);  // the start symbol
+
+      // A well-formed tree survives the serialization
+      tree_serialize(tree);
+      tree_t *tree2 = tree_deserialize(tree->ser_buf, tree->ser_len);
+      EXPECT_TRUE(tree_equal(tree, tree2));
+      tree_free(tree2);
+
+      tree_to_buf(tree);
+      avg_lens[i] += tree->data_len / 100.0;
+      tree_free(tree);
+
+    }
+
+  }
+
+  // The grammar may not have larger trees at all
+  EXPECT_GE(avg_lens[1], avg_lens[0]);
+
+#if GEN_HAS_BOLTZMANN
+  // Lengths are within a factor of two of the target, so they grow with the
+  // ten times larger target, if the grammar has such long trees
+  if (avg_lens[0] >= target_lens[0] / 2) {
+
+    EXPECT_GT(avg_lens[1], avg_lens[0] * 10 / 4);
+
+  }
+#endif
+
+}
+
+TEST_F(TreeTest, UnrankTrees) {
+
+  int num_sizes = 0;
+  for (int size = 0; size <= GEN_ENUM_MAX_SIZE && num_sizes < 3; ++size) {
+
+    uint64_t count = gen_count__(size);
+    if (!count) continue;
+    ++num_sizes;
+
+    // Distinct indices map to distinct trees of the given size
+    std::set<std::string> seen;
+    uint64_t              num = count < 100 ? count : 100;
+    for (uint64_t i = 0; i < num; ++i) {
+
+      tree_t *tree = gen_unrank__(size, i);
+      ASSERT_NE(tree, nullptr);
+      tree_to_buf(tree);
+      EXPECT_EQ(tree->data_len, (size_t)size);
+      tree_serialize(tree);
+      seen.insert(std::string((char *)tree->ser_buf, tree->ser_len));
+      tree_free(tree);
+
+    }
+
+    EXPECT_EQ(seen.size(), num);
+    if (count < UINT64_MAX) {
+
+      EXPECT_EQ(gen_unrank__(size, count), nullptr);
+
+    }
+
+  }
+
+  EXPECT_EQ(gen_count__(GEN_ENUM_MAX_SIZE + 1), 0u);
+
+}
+
 #if defined(ENABLE_PARSING_ARRAY_RB) && defined(ARRAY_RB_PATH)
 TEST_F(TreeTest, ParseArrayRb) {
 
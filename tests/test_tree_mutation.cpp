@@ -16,7 +16,8 @@
 
  */
 
-#include <array>
+#include <functional>
+#include <utility>
 #include <set>
 
 #include "chunk_store.h"
@@ -109,7 +110,7 @@ TEST(TreeMutationTest, SplicingMutation) {
   tree1->root = node1;
   tree2->root = node6;
 
-  chunk_store_init();
+  chunk_store_init(0);
 
   // mutate NULL
   auto tree3 = splicing_mutation(nullptr);
@@ -134,10 +135,84 @@ TEST(TreeMutationTest, SplicingMutation) {
 
 }
 
+TEST(TreeMutationTest, SplicingWithinMaxSize) {
+
+  random_set_seed(0);  // Fix the random seed
+  chunk_store_init(0);
+  for (int i = 0; i < 100; ++i) {
+
+    auto tree = gen_init__(1000);
+    chunk_store_add_tree(tree);
+    tree_free(tree);
+
+  }
+
+  auto tree = gen_init__(1000);
+  tree_get_size(tree);
+  tree_to_buf(tree);
+  size_t max_size = tree->data_len + 16;
+
+  size_t num_changed = 0;
+  for (int i = 0; i < 1000; ++i) {
+
+    auto mutated_tree = splicing_mutation_within(tree, max_size);
+    tree_to_buf(mutated_tree);
+    EXPECT_LE(mutated_tree->data_len, max_size);
+    if (!tree_equal(mutated_tree, tree)) ++num_changed;
+    tree_free(mutated_tree);
+
+  }
+
+  EXPECT_GT(num_changed, 0);
+
+  chunk_store_clear();
+  tree_free(tree);
+
+}
+
+TEST(TreeMutationTest, SplicingSharesSubtrees) {
+
+  random_set_seed(0);  // Fix the random seed
+  chunk_store_init(0);
+
+  // Every node type of the tree has a donor
+  auto tree = gen_init__(1000);
+  tree_get_size(tree);
+  chunk_store_add_tree(tree);
+
+  auto mutated_tree = splicing_mutation(tree);
+  ASSERT_NE(mutated_tree, nullptr);
+
+  // Count the nodes that the mutated tree did not copy
+  std::function<size_t(node_t *)> count_shared = [&](node_t *node) {
+
+    if (node->ref_count || node->share_count) return (size_t)1;
+    size_t n = 0;
+    for (uint32_t i = 0; i < node->subnode_count; ++i)
+      n += count_shared(node->subnodes[i]);
+    return n;
+
+  };
+
+  EXPECT_GT(count_shared(mutated_tree->root), 0);
+  tree_to_buf(mutated_tree);
+  std::string buf((char *)mutated_tree->data_buf, mutated_tree->data_len);
+
+  // Shared subtrees outlive the chunk store and the original tree
+  chunk_store_clear();
+  tree_free(tree);
+  tree_to_buf(mutated_tree);
+  EXPECT_EQ(std::string((char *)mutated_tree->data_buf, mutated_tree->data_len),
+            buf);
+
+  tree_free(mutated_tree);
+
+}
+
 class TreeMutationUniquenessTest : public ::testing::Test {
 
  protected:
-  std::set<std::array<char, 16+1>> tree_hash_set;
+  std::set<std::pair<uint64_t, uint64_t>> tree_hash_set;
 
   TreeMutationUniquenessTest() = default;
 
@@ -159,8 +234,8 @@ class TreeMutationUniquenessTest : public ::testing::Test {
     auto tmp_tree = gen_init__(1000);
     tree_get_size(tmp_tree);
 
-    tree_t *tree;
-    std::array<char, 16+1> tree_root_hash = {};
+    tree_t *   tree;
+    hash_key_t tree_root_hash;
 
     for (size_t i = 0; i < mutation_num; ++i) {
 
@@ -168,10 +243,10 @@ class TreeMutationUniquenessTest : public ::testing::Test {
       tree = func(tmp_tree);
 
       // calculate hash
-      hash_node(tree->root, tree_root_hash.data());
+      tree_root_hash = hash_node(tree->root);
 
       // insert to the set
-      tree_hash_set.insert(tree_root_hash);
+      tree_hash_set.insert({tree_root_hash.low64, tree_root_hash.high64});
 
       // free the tree
       tree_free(tree);
@@ -210,7 +285,7 @@ TEST_F(TreeMutationUniquenessTest, RandomRecursiveMutation) {
 TEST_F(TreeMutationUniquenessTest, SplicingMutation) {
 
   // initialize the chunk store
-  chunk_store_init();
+  chunk_store_init(0);
 
   // add 5 randomly generated trees
   for (int i = 0; i < 5; ++i) {
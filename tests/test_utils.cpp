@@ -0,0 +1,104 @@
+/*
+   american fuzzy lop++ - grammar mutator
+   --------------------------------------
+
+   Written by Shengtuo Hu
+
+   Copyright 2020 AFLplusplus Project. All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at:
+
+     http://www.apache.org/licenses/LICENSE-2.0
+
+   A grammar-based custom mutator written for GSoC '20.
+
+ */
+
+
+#include <vector>
+
+#include "utils.h"
+
+#include "gtest/gtest.h"
+
+using namespace std;
+
+TEST(RandomStateTest, IndependentContexts) {
+
+  random_state_t a, b, c;
+  random_state_set_seed(&a, 1);
+  random_state_set_seed(&b, 1);
+  random_state_set_seed(&c, 2);
+
+  // Draws from another context must not affect the sequence of `a`
+  vector<RANDOM_RETURN> expected;
+  for (int i = 0; i < 100; ++i)
+    expected.push_back(random_state_next(&b));
+
+  for (int i = 0; i < 100; ++i) {
+
+    random_state_next(&c);
+    EXPECT_EQ(random_state_next(&a), expected[i]);
+
+  }
+
+}
+
+TEST(RandomStateTest, GlobalApiUsesSelectedContext) {
+
+  random_state_t a, b;
+  random_state_set_seed(&a, 42);
+  random_state_set_seed(&b, 42);
+
+  vector<uint32_t> expected;
+  for (int i = 0; i < 100; ++i)
+    expected.push_back(random_state_below(&b, 1000));
+
+  random_state_t *prev = random_set_state(&a);
+  for (int i = 0; i < 100; ++i) {
+
+    EXPECT_EQ(random_below(1000), expected[i]);
+
+  }
+
+  random_set_state(prev);
+
+  // The default context of the thread is independent of `a`
+  random_set_seed(42);
+  random_state_set_seed(&a, 7);
+  random_state_set_seed(&b, 42);
+  for (int i = 0; i < 100; ++i) {
+
+    random_state_next(&a);
+    EXPECT_EQ(random_next(), random_state_next(&b));
+
+  }
+
+}
+
+TEST(RandomStateTest, MinBelowInRange) {
+
+  random_state_t state;
+  random_state_set_seed(&state, 0);
+  for (uint32_t num = 0; num < 16; ++num) {
+
+    for (int i = 0; i < 100; ++i) {
+
+      EXPECT_LT(random_state_min_below(&state, num, 10), 10u);
+
+    }
+
+  }
+
+  EXPECT_EQ(random_state_min_below(&state, 5, 1), 0u);
+
+}
+
+int main(int argc, char **argv) {
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+
+}